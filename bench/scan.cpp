@@ -0,0 +1,78 @@
+/**
+ * @file scan.cpp
+ * @author karurochari
+ * @brief Microbenchmark of the scanning kernels, reporting bytes per cycle for
+ * each implementation supported by the running CPU. Their correctness is
+ * checked by test/scan.cpp.
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <scan.hpp>
+#include <string>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <x86intrin.h>
+static inline uint64_t cycles() { return __rdtsc(); }
+static const char *UNIT = "bytes/cycle";
+#else
+static inline uint64_t cycles() {
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+static const char *UNIT = "bytes/tick";
+#endif
+
+using namespace vs::templ;
+
+constexpr size_t SIZE = 1 << 20;
+constexpr int ROUNDS = 64;
+
+// Plain text with one interesting byte in `every`, at random places.
+static std::string make_input(std::mt19937 &rng, size_t size, size_t every,
+                              const char *specials) {
+  std::string ret(size, 'a');
+  for (auto &c : ret)
+    c = 'a' + rng() % 26;
+  for (size_t i = 0; i < size / every; i++)
+    ret[rng() % size] = specials[rng() % strlen(specials)];
+  return ret;
+}
+
+template <typename F> static double measure(const std::string &input, F &&f) {
+  double best = 0;
+  for (int r = 0; r < ROUNDS; r++) {
+    uint64_t start = cycles();
+    size_t pos = 0;
+    while (pos < input.size())
+      pos += f(input.data() + pos, input.size() - pos) + 1;
+    uint64_t elapsed = cycles() - start;
+    best = std::max(best, (double)input.size() / elapsed);
+  }
+  return best;
+}
+
+int main() {
+  std::mt19937 rng(42);
+  auto kernels = scan_all_kernels();
+
+  auto paths = make_input(rng, SIZE, 64, "/~");
+  auto text = make_input(rng, SIZE, 256, "&<>\"");
+  for (auto *k : kernels) {
+    double delims = measure(paths, [&](const char *s, size_t n) {
+      return k->find_any(s, n, '/', '~');
+    });
+    double escape = measure(text, [&](const char *s, size_t n) {
+      return k->find_escape(s, n, true);
+    });
+    std::cout << k->name << ":\tdelimiters " << delims << " " << UNIT
+              << "\tescape " << escape << " " << UNIT << "\n";
+  }
+  std::cout << "in use: " << scan_kernels().name << "\n";
+  return 0;
+}
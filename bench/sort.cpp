@@ -0,0 +1,68 @@
+/**
+ * @file sort.cpp
+ * @author karurochari
+ * @brief Benchmark of s:for over a large collection with sorting, sequential
+ * against the parallel path on the shared thread pool. Keys have many ties,
+ * the two outputs must be identical.
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <chrono>
+#include <iostream>
+#include <pugixml.hpp>
+#include <sstream>
+#include <string>
+#include <vs-templ.hpp>
+
+using namespace vs::templ;
+
+constexpr int ITEMS = 250000;
+
+static const char *TEMPLATE = R"(<document xmlns:s="vs.templ">
+  <s:for in="$/items/" sort-by="$~group,$~name" order-by="asc,desc:num"><s:item><i><s:value src="$~id" /></i></s:item></s:for>
+</document>)";
+
+static double run(preprocessor &doc, std::string &output) {
+  render_context ctx;
+  auto start = std::chrono::steady_clock::now();
+  doc.render(ctx);
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::stringstream serial;
+  ctx.result().print(serial);
+  output = serial.str();
+  return elapsed.count();
+}
+
+int main() {
+  pugi::xml_document data, tmpl;
+  auto items = data.append_child("items");
+  for (int i = 0; i < ITEMS; i++) {
+    auto item = items.append_child("item");
+    item.append_attribute("id").set_value(i);
+    item.append_attribute("group").set_value(
+        ("g" + std::to_string((i * 7919) % 97)).c_str());
+    item.append_attribute("name").set_value((i * 31) % 1000);
+  }
+  if (!tmpl.load_string(TEMPLATE)) {
+    std::cerr << "Unable to load the template\n";
+    return 1;
+  }
+
+  preprocessor doc(data, tmpl.root());
+  std::string sequential, parallel;
+  doc.parallel_threshold(0);
+  double t_sequential = run(doc, sequential);
+  doc.parallel_threshold(1);
+  double t_parallel = run(doc, parallel);
+
+  std::cout << "sequential: " << t_sequential << "ms\n";
+  std::cout << "parallel:   " << t_parallel << "ms\n";
+
+  if (sequential != parallel) {
+    std::cerr << "The two renders differ\n";
+    return 2;
+  }
+  return 0;
+}
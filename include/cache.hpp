@@ -0,0 +1,61 @@
+#pragma once
+
+/**
+ * @file cache.hpp
+ * @author karurochari
+ * @brief Opt-in cache of whole renders, stored on disk and addressed by the content of their inputs.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace vs{
+namespace templ{
+
+/**
+ * @brief Directory of rendered documents, each one named after a hash of everything its output depends on.
+ * The caller decides what goes into the key (template and data bytes, namespace prefix, seed, options), and the
+ * version of the library is always part of it. Every entry keeps the serialized output and the logs of its render.
+ * Once the entries take more than `max_size` bytes, the least recently used ones are removed.
+ * The cache is only an optimization: any failure to read or write it is treated as a miss.
+ */
+struct render_cache{
+    private:
+        std::filesystem::path dir;
+        size_t max_size;
+
+        std::filesystem::path path(const std::string& key, const char* ext) const;
+
+    public:
+        render_cache(const std::filesystem::path& dir, size_t max_size = 64*1024*1024);
+
+        //Hash of all the parts, in order, along with the version of the library.
+        static std::string key(const std::vector<std::string_view>& parts);
+
+        /**
+         * @brief Copy a stored output to a file descriptor, without going through user space buffers if possible.
+         *
+         * @param key as computed by `key`
+         * @param fd destination of the output
+         * @param logs if not null, it receives the logs stored with the entry
+         * @return true on a hit, false if there is no usable entry
+         */
+        bool fetch(const std::string& key, int fd, std::string* logs = nullptr) const;
+
+        //Save an entry, then evict older ones if the cache is over its size.
+        void store(const std::string& key, std::string_view output, std::string_view logs);
+
+        //Remove the least recently used entries until the cache fits its size.
+        //Temporary files and logs left behind by interrupted writes count towards it, and are removed once stale.
+        //Only files named after a key are considered, anything else in the directory is left alone.
+        void evict();
+};
+
+}
+}
@@ -1,24 +1,126 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <variant>
+#include <vector>
 
 namespace vs{
 namespace templ{
 
+/**
+ * @brief Entry in the log of a render.
+ * It only records what happened, where in the template and a couple of small arguments.
+ * The human readable message is built on request by `description()`.
+ * String arguments are not copied: they must point to static strings or to the template, which must outlive the entry.
+ */
 struct log_t{
+    //Values of the original levels are kept, use `severity` to compare them.
     enum values{
-        ERROR, WARNING, PANIC
+        ERROR, WARNING, PANIC, INFO,
+
+        LEVELS
     };
 
+    //Rank of a level, from INFO to PANIC.
+    static constexpr int severity(values v){
+        constexpr int ranks[] = {2, 1, 3, 0};
+        return v<LEVELS?ranks[v]:LEVELS;
+    }
+
+    enum codes{
+        UNKNOWN_OPERATION,          //arg0: name of the element
+        UNKNOWN_PROP_OPERATION,     //arg0: name of the attribute
+        RENDER_ABORTED,             //arg0: name of the budget which was exceeded
+        RENDER_CANCELLED,
+    };
+
+    typedef std::variant<std::monostate,int64_t,const char*> arg_t;
+
     private:
         values _type;
-        std::string _description;
+        codes _code;
+        ptrdiff_t _node;
+        std::array<arg_t,2> _args;
     public:
-        inline log_t(values type, std::string description):_type(type),_description(description){}
+        inline log_t() = default;
+        inline log_t(values type, codes code, ptrdiff_t node, arg_t arg0 = {}, arg_t arg1 = {}):_type(type),_code(code),_node(node),_args{arg0,arg1}{}
 
         values type() const{return _type;}
-        const std::string& description() const{return _description;}
+        codes code() const{return _code;}
+        //Offset of the template node in its source, -1 if not available.
+        ptrdiff_t node() const{return _node;}
+        const arg_t& arg(size_t i) const{return _args[i];}
+
+        std::string description() const;
+
+        static const char* to_string(values v);
 };
 
+/**
+ * @brief Fixed capacity ring buffer of log entries.
+ * Storage is allocated once, so recording an entry never allocates. When full, the oldest entries are overwritten.
+ * Entries below the minimum level are only counted. Counters keep track of every entry, even those no longer stored.
+ */
+struct logger_t{
+    private:
+        std::vector<log_t> ring;
+        size_t head = 0;
+        size_t stored = 0;
+        log_t::values min_level = log_t::INFO;
+        std::array<size_t,log_t::LEVELS> counters{};
+
+    public:
+        struct iterator{
+            private:
+                const logger_t* ref;
+                size_t i;
+            public:
+                inline iterator(const logger_t* ref, size_t i):ref(ref),i(i){}
+                inline const log_t& operator*() const{return ref->ring[(ref->head+ref->ring.size()-ref->stored+i)%ref->ring.size()];}
+                inline const log_t* operator->() const{return &**this;}
+                inline iterator& operator++(){i++;return *this;}
+                inline bool operator==(const iterator& other) const{return i==other.i;}
+                inline bool operator!=(const iterator& other) const{return i!=other.i;}
+        };
+
+        inline logger_t(size_t capacity = 256, log_t::values min_level = log_t::INFO){configure(capacity,min_level);}
+
+        inline void configure(size_t capacity, log_t::values min_level){
+            ring.assign(capacity==0?1:capacity,log_t());
+            this->min_level=min_level;
+            clear();
+        }
+
+        inline void clear(){head=0;stored=0;counters.fill(0);}
+
+        inline void push(const log_t& entry){
+            counters[entry.type()]++;
+            if(log_t::severity(entry.type())<log_t::severity(min_level))return;
+            ring[head]=entry;
+            head=(head+1)%ring.size();
+            if(stored<ring.size())stored++;
+        }
+
+        //Oldest to newest
+        inline iterator begin() const{return iterator(this,0);}
+        inline iterator end() const{return iterator(this,stored);}
+        inline size_t size() const{return stored;}
+        inline bool empty() const{return stored==0;}
+
+        //Number of entries recorded for a given level, including those which were filtered or overwritten.
+        inline size_t count(log_t::values level) const{return counters[level];}
+        //Number of entries at or above the minimum level which are no longer stored.
+        inline size_t dropped() const{
+            size_t total=0;
+            for(size_t i=0;i<log_t::LEVELS;i++){
+                if(log_t::severity((log_t::values)i)>=log_t::severity(min_level))total+=counters[i];
+            }
+            return total-stored;
+        }
+};
+
+}
 }
-}
\ No newline at end of file
@@ -0,0 +1,141 @@
+#pragma once
+
+/**
+ * @file registry.hpp
+ * @author karurochari
+ * @brief Shared cache of compiled templates, for hosts instantiating the same templates over and over.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <pugixml.hpp>
+
+#include "vs-templ.hpp"
+
+namespace vs{
+namespace templ{
+
+/**
+ * @brief A template parsed and compiled once, never modified afterwards.
+ * It is not bound to any data: each render is given its own data root, and any number of threads can render it at once.
+ */
+struct compiled_template{
+    private:
+        pugi::xml_document doc;
+        preprocessor _processor;
+        size_t _cost = 0;
+        bool _ok = false;
+
+        void compile(const pugi::xml_parse_result& result, const char* prefix, uint64_t seed, const limits_t& limits);
+
+    public:
+        //Use `ok()` to know if parsing succeeded.
+        compiled_template(const std::filesystem::path& path, const char* prefix = "s:", uint64_t seed = 0, const limits_t& limits = {});
+        compiled_template(std::string_view source, const char* prefix = "s:", uint64_t seed = 0, const limits_t& limits = {});
+        compiled_template(const compiled_template&) = delete;
+
+        inline bool ok() const{return _ok;}
+
+        //Estimate of the memory taken, in bytes.
+        inline size_t cost() const{return _cost;}
+
+        //To render with a context of its own, or in chunks via `render_chunks`. Its data root is empty.
+        inline const preprocessor& processor() const{return _processor;}
+
+        //Render against `data`, leaving the output in `ctx.result()`.
+        inline void render(render_context& ctx, const pugi::xml_node& data) const{_processor.render(ctx,data);}
+
+        /**
+         * @brief Render against `data` and save the output to `sink`.
+         *
+         * @param data root of the data
+         * @param sink destination of the serialized output
+         * @return the reason for the render to be aborted, if it was
+         */
+        abort_t::values render(const pugi::xml_node& data, pugi::xml_writer& sink) const;
+};
+
+struct registry_options_t{
+    size_t max_cost = 64*1024*1024;     //Estimated memory of all the templates, past which the oldest are evicted.
+    bool check_mtime = false;           //Reload templates from paths whose file was modified since their last load.
+    const char* prefix = "s:";          //Namespace prefix of the templates.
+    uint64_t seed = 0;
+    limits_t limits;                    //Budgets enforced on each render.
+};
+
+/**
+ * @brief Thread-safe map from keys to compiled templates, evicting the least recently used ones past a memory budget.
+ * Keys are up to the host: paths, ids or hashes of the content. Templates are handed out as shared pointers, so an
+ * evicted or invalidated template stays valid for as long as someone still renders it.
+ */
+struct template_registry{
+    struct stats_t{
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t reloads = 0;                 //Templates reloaded as their file was modified.
+        size_t evictions = 0;
+        size_t failures = 0;                //Templates which could not be loaded or parsed.
+        size_t entries = 0;
+        size_t cost = 0;
+    };
+
+    private:
+        struct entry_t{
+            std::shared_ptr<const compiled_template> value;
+            std::optional<std::filesystem::file_time_type> mtime;
+            std::list<std::string>::iterator used;
+        };
+
+        registry_options_t options;
+
+        mutable std::mutex mtx;
+        std::unordered_map<std::string,entry_t,string_hash,std::equal_to<>> entries;
+        //Keys from the most to the least recently used.
+        std::list<std::string> lru;
+        stats_t _stats;
+
+        std::shared_ptr<const compiled_template> lookup(std::string_view key, const std::optional<std::filesystem::file_time_type>& mtime);
+        std::shared_ptr<const compiled_template> insert(std::string_view key, std::shared_ptr<const compiled_template>&& value, const std::optional<std::filesystem::file_time_type>& mtime);
+        void drop(decltype(entries)::iterator it);
+
+    public:
+        inline template_registry(const registry_options_t& options = {}):options(options){}
+
+        /**
+         * @brief Get the template in the file at `path`, loading it on a miss.
+         * With `check_mtime`, the file is checked on each call and reloaded if modified.
+         *
+         * @param path of the template, also used as key
+         * @return the compiled template, or null if the file could not be loaded
+         */
+        std::shared_ptr<const compiled_template> get(const std::string& path);
+
+        /**
+         * @brief Get the template for `key`, compiling `source` on a miss.
+         *
+         * @param key an id or a hash of the content
+         * @param source XML of the template, only parsed on a miss
+         * @return the compiled template, or null if the source could not be parsed
+         */
+        std::shared_ptr<const compiled_template> get(std::string_view key, std::string_view source);
+
+        void erase(std::string_view key);
+        void clear();
+
+        stats_t stats() const;
+};
+
+}
+}
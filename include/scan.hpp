@@ -0,0 +1,36 @@
+#pragma once
+
+/**
+ * @file scan.hpp
+ * @author karurochari
+ * @brief Byte scanning kernels for the hot loops, vectorized where the CPU allows it.
+ * An implementation is picked once at runtime: AVX2 or SSE2 on x86-64, a scalar one anywhere else.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <cstddef>
+#include <vector>
+
+namespace vs{
+namespace templ{
+
+struct scan_kernels_t{
+    const char* name;
+
+    //Index of the first byte equal to `a` or `b` within `len` bytes, `len` if none.
+    size_t (*find_any)(const char* str, size_t len, char a, char b);
+    //Index of the first byte to escape in XML text (`&<>` and control characters but tabs and newlines), `len` if none.
+    //Attribute values also escape `"` and all control characters.
+    size_t (*find_escape)(const char* str, size_t len, bool attribute);
+};
+
+//Fastest implementation supported by the running CPU.
+const scan_kernels_t& scan_kernels();
+
+//Every implementation supported by the running CPU, scalar first. Meant for tests and benchmarks.
+std::vector<const scan_kernels_t*> scan_all_kernels();
+
+}
+}
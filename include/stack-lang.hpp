@@ -27,11 +27,11 @@ struct repl{
             Types not being satisfied are evaluated dynamically by functions and will result in runtime errors saved on stack.
             Determinations about the numbers of element to pop from the stack are done at runtime as well.
         */
-        std::optional<concrete_symbol> eval(const preprocessor& p, pugi::xml_node* base=nullptr) noexcept{
+        std::optional<concrete_symbol> eval(const preprocessor& p, const render_context& ctx, pugi::xml_node* base=nullptr) noexcept{
             while(!stack.empty()){
                 auto top = stack.top();
                 stack.pop();
-                if(top.first==item_t::EXPR)return p.resolve_expr(top.second, base);
+                if(top.first==item_t::EXPR)return p.resolve_expr(ctx, top.second, base);
                 //If I end up with an error which I am not able to fix I will just return an empty result.
                 else if (stack.size()==0 && top.first==item_t::ERROR)return {};
                 else{
@@ -0,0 +1,113 @@
+#pragma once
+
+/**
+ * @file stream.hpp
+ * @author karurochari
+ * @brief Chunked rendering, to start consuming the output while the render is still going on.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "vs-templ.hpp"
+
+namespace vs{
+namespace templ{
+
+/**
+ * @brief Options of a chunked render.
+ * `max_buffered` bounds the queue between the render and its consumer. The serialized form of a single static subtree
+ * or spliced `s:value` is still built in one go by the render before being queued, a piece at a time.
+ */
+struct stream_options_t{
+    size_t chunk_size = 4096;           //Size of each chunk, except for the last one.
+    size_t max_buffered = 64*1024;      //Output produced but not consumed yet, past which the render waits.
+};
+
+/**
+ * @brief Bounded queue of serialized output, from a render to its consumer on another thread.
+ */
+struct stream_buffer{
+    private:
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::string data;
+        size_t max_buffered;
+        bool closed = false;
+        bool cancelled = false;
+
+    public:
+        inline stream_buffer(size_t max_buffered):max_buffered(max_buffered){}
+
+        //Producer side. Waits while the buffer is full, queueing `bytes` in pieces if needed. Returns false once the consumer has cancelled.
+        bool write(std::string_view bytes);
+        //Producer side. No more output will follow.
+        void close();
+
+        //Consumer side. Waits for `size` bytes, or for whatever is left once closed. Returns false at the end of the output.
+        bool read(std::string& chunk, size_t size);
+        //Consumer side. Stop the producer at its next write.
+        void cancel();
+};
+
+/**
+ * @brief Generator of output chunks, to be iterated with a range-based for.
+ * Each chunk is only valid until the next one is requested. Destroying the generator early cancels the render.
+ */
+struct chunk_generator{
+    struct promise_type{
+        std::string_view current;
+
+        inline chunk_generator get_return_object(){return chunk_generator(std::coroutine_handle<promise_type>::from_promise(*this));}
+        inline std::suspend_always initial_suspend() noexcept{return {};}
+        inline std::suspend_always final_suspend() noexcept{return {};}
+        inline std::suspend_always yield_value(std::string_view chunk) noexcept{current=chunk;return {};}
+        inline void return_void(){}
+        inline void unhandled_exception(){std::terminate();}
+    };
+
+    struct iterator{
+        std::coroutine_handle<promise_type> handle;
+
+        inline iterator& operator++(){handle.resume();return *this;}
+        inline std::string_view operator*() const{return handle.promise().current;}
+        inline bool operator==(std::default_sentinel_t) const{return handle.done();}
+    };
+
+    private:
+        std::coroutine_handle<promise_type> handle;
+        inline explicit chunk_generator(std::coroutine_handle<promise_type> handle):handle(handle){}
+
+    public:
+        inline chunk_generator(chunk_generator&& other):handle(std::exchange(other.handle,{})){}
+        chunk_generator(const chunk_generator&) = delete;
+        inline ~chunk_generator(){if(handle)handle.destroy();}
+
+        inline iterator begin(){handle.resume();return iterator{handle};}
+        inline std::default_sentinel_t end(){return {};}
+};
+
+/**
+ * @brief Render on a separate thread, yielding the serialized output in chunks as it becomes available.
+ * The preprocessor and the context must outlive the generator. The context is only safe to inspect once the
+ * generator is exhausted or destroyed, and its `result()` is left empty as the output is moved out of it.
+ *
+ * @param doc the preprocessor to render
+ * @param ctx the per-render state
+ * @param options size of the chunks and bound on the buffered output
+ * @return chunk_generator
+ */
+chunk_generator render_chunks(const preprocessor& doc, render_context& ctx, stream_options_t options = {});
+
+}
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <map>
 #include <optional>
 #include <variant>
@@ -10,10 +11,10 @@ namespace vs{
 namespace templ{
 
 //Symbol which can be saved in the table
-typedef std::variant<int,const pugi::xml_node, const pugi::xml_attribute> symbol;
+typedef std::variant<int64_t,double,const pugi::xml_node, const pugi::xml_attribute> symbol;
 
 //Extended symbol which is the result of computations. String is introduced as they cannot be set as values for symbols, but they can be computed.
-typedef std::variant<int,const pugi::xml_node, const pugi::xml_attribute, std::string> concrete_symbol;
+typedef std::variant<int64_t,double,const pugi::xml_node, const pugi::xml_attribute, std::string> concrete_symbol;
 
 //Utility class to implement a list of symbols. Use for `for` like structures in pattern matching.
 struct symbol_map{
@@ -32,7 +33,7 @@ struct symbol_map{
             symbols.pop_back();
         };
 
-        void reset(){symbols=decltype(symbols)();}
+        void reset(){symbols=decltype(symbols)();new_frame();}
 
         std::optional<symbol> resolve(std::string_view name) const{
             for(auto it = symbols.rbegin();it!=symbols.rend();it++){
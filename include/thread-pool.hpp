@@ -0,0 +1,49 @@
+#pragma once
+
+/**
+ * @file thread-pool.hpp
+ * @author karurochari
+ * @brief Worker threads shared by the whole engine, to split large pieces of work within a render.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vs{
+namespace templ{
+
+struct thread_pool{
+    private:
+        std::vector<std::thread> workers;
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<std::function<void()>> tasks;
+        bool stopping = false;
+
+    public:
+        thread_pool(size_t threads);
+        thread_pool(const thread_pool&) = delete;
+        ~thread_pool();
+
+        inline size_t size() const{return workers.size();}
+
+        /**
+         * @brief Run `fn(i)` for every `i` in `[0,n)`, on the pool and on the calling thread, returning once all are done.
+         * The calling thread takes part in the work, so nested calls and a busy pool never stall it.
+         */
+        void parallel_for(size_t n, const std::function<void(size_t)>& fn);
+
+        //Pool sized after the hardware, created on first use.
+        static thread_pool& shared();
+};
+
+}
+}
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <cstring>
+#include <functional>
+#include <optional>
+#include <string_view>
 #include <variant>
 #include <vector>
 #include <string>
@@ -21,8 +25,15 @@ const T& get_or(const auto& ref, const T& defval) noexcept{
     else return defval;
 }
 
+///Hash for string-keyed maps which can be searched by string_view without building a string
+struct string_hash{
+    using is_transparent = void;
+    inline size_t operator()(std::string_view str) const{return std::hash<std::string_view>{}(str);}
+};
+
 /**
  * @brief Generate a list of string views when a delimiter is matched on a reference string.
+ * Consecutive delimiters, or one at either end, give empty segments.
  * 
  * @param str the string to check
  * @param delim the delimiter character
@@ -36,14 +47,45 @@ inline constexpr std::size_t cexpr_strlen(const char* s){return std::char_traits
 ///Compare strings where the right one is defined at comptime
 inline bool cexpr_strneqv(const char* s, const char* c){return strncmp(s, c, cexpr_strlen(c))==0;}
 
+///Numeric value, either integer or floating point
+typedef std::variant<int64_t,double> number_t;
+
+/**
+ * @brief Parse a string as a base 10 number via `std::from_chars`.
+ * An optional leading `+` is accepted. Integers are preferred, floating point is used if that fails.
+ * 
+ * @param str the string to parse
+ * @param partial if set, trailing characters are ignored as long as some prefix is a number
+ * @return std::optional<number_t> the number, or nothing if the string is not one
+ */
+std::optional<number_t> parse_number(std::string_view str, bool partial=false);
+
+/**
+ * @brief Three-way numeric comparison. Integers are compared exactly, mixed pairs as floating point.
+ */
+int cmp_number(const number_t& a, const number_t& b);
+
+/**
+ * @brief Normalize a number so that equal values have the same representation (eg. `2.0` becomes `2`), to use it as a key.
+ */
+number_t normalize_number(const number_t& n);
+
+/**
+ * @brief Write a number in its shortest exact form.
+ */
+std::string number_to_string(const number_t& n);
+
 /**
- * @brief Compare two strings assuming the dot notation for ordering nested fields
+ * @brief Compare two strings assuming the dot notation for ordering nested fields.
+ * Segments are compared one at a time, and a string comes before any other it is a dot-prefix of (`a` < `a.b` < `a.c` < `b`).
+ * It does not allocate, and it is a proper three-way comparison (0 only for equal strings in non-natural mode).
  * 
  * @param a 
  * @param b 
- * @return int 
+ * @param natural if set, segments made only of digits are compared by their numeric value and come before other segments (eg. version strings, `1.9` < `1.10`)
+ * @return int negative, zero or positive like strcmp
  */
-int cmp_dot_str(const char* a, const char* b);
+int cmp_dot_str(const char* a, const char* b, bool natural=false);
 
 }
 }
\ No newline at end of file
@@ -9,31 +9,66 @@
  * 
  */
 
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <optional>
 #include <stack>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include <pugixml.hpp>
 
 #include "symbols.hpp"
 #include "logging.hpp"
+#include "utils.hpp"
 
 namespace vs{
 namespace templ{
 
+struct stream_buffer;
 
-struct preprocessor{
+//Placeholders in the output of a streamed render, each standing for a data subtree to be written in its place.
+typedef std::unordered_map<const pugi::xml_node_struct*,pugi::xml_node> splices_t;
+
+/**
+ * @brief Budgets for a single render, to stop runaway templates early. Zero means unlimited.
+ */
+struct limits_t{
+    size_t max_nodes = 0;               //Nodes appended to the output document.
+    size_t max_bytes = 0;               //Bytes of names, values and attributes written to the output document.
+    size_t max_iterations = 0;          //Iterations across all the cycles of the render.
+    size_t max_depth = 0;               //Nesting of template blocks being evaluated.
+    std::chrono::milliseconds deadline{0};  //Wall-clock time since the start of the render.
+    bool discard_partial = false;       //If set, an aborted render leaves an empty document behind.
+};
+
+/**
+ * @brief Reason for a render to be stopped before its natural end.
+ */
+struct abort_t{
+    enum values{
+        NONE, NODES, BYTES, ITERATIONS, DEPTH, DEADLINE,
+        CANCELLED   //Not a budget, the consumer of a streamed render went away.
+    };
+
+    static const char* to_string(values v);
+};
+
+/**
+ * @brief Mutable state of a single render.
+ * A context is owned by exactly one thread at a time, while the preprocessor it is used with can be shared.
+ */
+struct render_context{
     private:
+        friend struct preprocessor;
         friend struct repl;
 
-        std::string ns_prefix;
-        uint64_t seed;
-
         //Final document to be shared
         pugi::xml_document compiled;
 
@@ -42,32 +77,188 @@ struct preprocessor{
         std::stack<pugi::xml_node_iterator> stack_data;
         std::stack<std::pair<pugi::xml_node_iterator,pugi::xml_node_iterator>> stack_template;
 
-        std::vector<log_t> _logs;
+        logger_t _logs;
+
+        //Data root of this render, the one of the preprocessor unless given to `render`.
+        pugi::xml_node root_data;
 
         //Stack-like table of symbols
         symbol_map symbols;
 
+        //Resources consumed so far, checked against limits_t
+        size_t used_nodes = 0;
+        size_t used_bytes = 0;
+        size_t used_iterations = 0;
+        size_t ticks = 0;
+        std::chrono::steady_clock::time_point started;
+        abort_t::values _aborted = abort_t::NONE;
+
+        //Streamed renders only. Finished output is serialized and moved out of `compiled` every few bytes.
+        stream_buffer* _stream = nullptr;
+        size_t flush_every = 0;
+        size_t flushed_bytes = 0;
+        //Elements whose start tag has been written already, from the outermost.
+        std::vector<pugi::xml_node> opened;
+        std::string pending;
+        splices_t spliced;
+
+        //Collections filtered and sorted so far, by data node and settings, for later cycles to reuse.
+        std::unordered_map<std::string,std::shared_ptr<const std::vector<pugi::xml_node>>,string_hash,std::equal_to<>> prepared_children;
+        std::unordered_map<std::string,std::shared_ptr<const std::vector<pugi::xml_attribute>>,string_hash,std::equal_to<>> prepared_props;
+
+    public:
+        void reset();
+
+        inline abort_t::values aborted() const{return _aborted;}
+
+        inline const logger_t& logs() const{return _logs;}
+        inline void configure_logs(size_t capacity, log_t::values min_level = log_t::INFO){_logs.configure(capacity,min_level);}
+        inline void log(log_t::values type, log_t::codes code, ptrdiff_t node, log_t::arg_t arg0 = {}, log_t::arg_t arg1 = {}){
+            //TODO: Handling of panic should terminate the process right away (?)
+            _logs.push(log_t(type,code,node,arg0,arg1));
+        }
+
+        inline pugi::xml_document& result(){return compiled;}
+};
+
+/**
+ * @brief Immutable pairing of a data tree and a template tree.
+ * Once initialized, `render` only reads from it and from the two trees. Any number of threads can render the same
+ * preprocessor at the same time, as long as each of them uses its own `render_context` and nobody modifies the
+ * data or template documents while renders are in flight (pugixml is safe for concurrent reads, not for writes).
+ * The legacy `parse`/`logs`/`reset` interface works on an internal context and is not thread-safe.
+ */
+struct preprocessor{
+    private:
+        friend struct repl;
+
+        std::string ns_prefix;
+        uint64_t seed;
+
         //Entry point in the root document.
         pugi::xml_node root_data;
+        //Further data documents, reachable as `{name}/...`.
+        std::vector<std::pair<std::string,pugi::xml_node>> named_data;
+        //Entry point in the template.
+        pugi::xml_node root_template;
+
+        //Budgets enforced on each render.
+        limits_t _limits;
+
+        //Collections this large or more are sorted on the shared thread pool.
+        size_t _parallel_threshold = 1<<16;
+
+        //Context used by the single-threaded interface.
+        render_context ctx;
 
     public:
         inline preprocessor(const pugi::xml_node& root_data, const pugi::xml_node& root_template, const char* prefix="s:", uint64_t seed = 0){
-            init(root_data,root_template,prefix);
+            init(root_data,root_template,prefix,seed);
         }
 
         void init(const pugi::xml_node& root_data, const pugi::xml_node& root_template, const char* prefix="s:", uint64_t seed = 0);
-        void reset();
+        inline void reset(){ctx.reset();}
+
+        inline const logger_t& logs() const{return ctx.logs();}
+        inline void configure_logs(size_t capacity, log_t::values min_level = log_t::INFO){ctx.configure_logs(capacity,min_level);}
+        inline abort_t::values aborted() const{return ctx.aborted();}
+
+        inline pugi::xml_document& parse(){render(ctx);return ctx.compiled;}
+
+        /**
+         * @brief Render the template against the data, using only the state found in `ctx`.
+         * 
+         * @param ctx the per-render state, reset before use. The result is available via `ctx.result()`.
+         */
+        void render(render_context& ctx) const;
+
+        /**
+         * @brief Render while writing the serialized output to `out`, as soon as each part of it is final.
+         * Written nodes are dropped from `ctx.result()`. Once an abort happens, what was already written stays written.
+         * See `render_chunks` in stream.hpp for a generator built on top of it.
+         * 
+         * @param ctx the per-render state, reset before use
+         * @param out destination of the output, closed by the caller
+         * @param flush_every how many output bytes to accumulate between writes
+         */
+        void render(render_context& ctx, stream_buffer& out, size_t flush_every) const;
+
+        /**
+         * @brief Render the template against a data root other than the one given at construction.
+         * This way a single compiled template can be shared by renders of unrelated data documents.
+         * 
+         * @param ctx the per-render state, reset before use
+         * @param data root of the data for this render only, as `$` and `/`
+         */
+        void render(render_context& ctx, const pugi::xml_node& data) const;
+
+        inline void ns(const char* str){ns_prefix = str;strings.prepare(str);compile();}
+
+        /**
+         * @brief Add a data root besides the main one, to be used in expressions as `{name}/...`.
+         * Each root can come from its own document, so that there is no need to merge them first.
+         * Symbols defined by the template with the same name take precedence within their scope.
+         * 
+         * @param name of the root
+         * @param root node to be used as root
+         */
+        inline void add_data(std::string_view name, const pugi::xml_node& root){named_data.emplace_back(name,root);}
+
+        //Size from which `s:for` collections have their keys extracted and sorted in parallel, 0 to never do it.
+        inline void parallel_threshold(size_t value){_parallel_threshold=value;}
+
+        inline void limits(const limits_t& value){_limits=value;}
+        inline const limits_t& limits() const{return _limits;}
+
+    protected:
+        //Namespace elements known to the preprocessor, as recognized by their local name.
+        struct tag_t{
+            enum values{
+                NONE,       //Not in the namespace
+                UNKNOWN,    //In the namespace, but not a known name
+                FOR_RANGE, FOR, FOR_PROPS, EMPTY, HEADER, FOOTER, ITEM, ERROR,
+                WHEN, IS,
+                VALUE, EVAL, ELEMENT,
+            };
 
-        inline const std::vector<log_t> logs(){return _logs;}
-        inline void log(log_t::values type, const char* msg, ...){
-            //TODO: Handling of panic should terminate the process right away (?)
-            //TODO: Interpolate/format string
-            //https://stackoverflow.com/questions/2342162/stdstring-formatting-like-sprintf
-            _logs.emplace_back(type,msg);
-        }
+            //Classify the local name of an element, the part after the namespace prefix.
+            static inline values from_suffix(const char* str){
+                //Names are told apart by length first, so at most a couple of short compares are needed.
+                switch(strnlen(str,10)){
+                    case 2: if(memcmp(str,"is",3)==0)return IS; break;
+                    case 3: if(memcmp(str,"for",4)==0)return FOR; break;
+                    case 4:
+                        if(memcmp(str,"when",5)==0)return WHEN;
+                        if(memcmp(str,"item",5)==0)return ITEM;
+                        if(memcmp(str,"eval",5)==0)return EVAL;
+                        break;
+                    case 5:
+                        if(memcmp(str,"value",6)==0)return VALUE;
+                        if(memcmp(str,"empty",6)==0)return EMPTY;
+                        if(memcmp(str,"error",6)==0)return ERROR;
+                        break;
+                    case 6:
+                        if(memcmp(str,"header",7)==0)return HEADER;
+                        if(memcmp(str,"footer",7)==0)return FOOTER;
+                        break;
+                    case 7: if(memcmp(str,"element",8)==0)return ELEMENT; break;
+                    case 9:
+                        if(memcmp(str,"for-range",10)==0)return FOR_RANGE;
+                        if(memcmp(str,"for-props",10)==0)return FOR_PROPS;
+                        break;
+                }
+                return UNKNOWN;
+            }
+        };
 
-        inline pugi::xml_document& parse(){_parse({});return compiled;}
-        inline void ns(const char* str){ns_prefix = str;strings.prepare(str);}
+        //Whether a name is in the namespace. Prefixes are a couple of bytes long, a plain compare is the fastest.
+        inline bool in_ns(const char* name) const{return strncmp(name,ns_prefix.c_str(),ns_prefix.length())==0;}
+
+        //Classify an element name against the namespace prefix.
+        inline tag_t::values classify(const char* name) const{
+            if(!in_ns(name))return tag_t::NONE;
+            return tag_t::from_suffix(name+ns_prefix.length());
+        }
 
     private:
         struct order_method_t{
@@ -77,7 +268,8 @@ struct preprocessor{
                 DESC, 
                 RANDOM,
 
-                USE_DOT_EVAL = 16 //For strings, split evaluation based on their dot groups. Valid for all methods.
+                USE_DOT_EVAL = 16, //For strings, split evaluation based on their dot groups. Valid for all methods.
+                USE_NUMERIC = 32,  //Cast keys to numbers before comparing them, with the `:num` suffix. Keys which are not numbers sort after all numbers. With USE_DOT_EVAL, numeric segments are compared by value instead.
             };
 
             static values from_string(std::string_view str);
@@ -138,17 +330,108 @@ struct preprocessor{
 
         }strings;
 
+        //Dispatch table for a `when` whose `is` values are all literals.
+        struct when_table_t{
+            std::vector<pugi::xml_node> cases;
+            std::vector<bool> continues;
+            //For each literal value, the indices of the matching cases in document order.
+            std::unordered_map<std::string,std::vector<uint32_t>,string_hash,std::equal_to<>> by_string;
+            std::unordered_map<number_t,std::vector<uint32_t>> by_number;
+            //String literals which can also be read as numbers, to be matched by numeric subjects.
+            std::unordered_map<number_t,std::vector<uint32_t>> by_numeric_string;
+        };
+
+        //Size of a static subtree, precomputed for the output budgets.
+        struct static_t{
+            size_t nodes = 0;
+            size_t bytes = 0;
+        };
+
+        //Attributes of a plain element using namespace props, sorted out once.
+        struct props_t{
+            //`for.SUB-ATTR.xxx` or `for-props.SUB-ATTR.xxx` props sharing the same `xxx`.
+            struct cycle_t{
+                tag_t::values type;
+                const char* group;
+                const char *in = nullptr, *sort_by = "", *order_by = "asc", *limit = "0", *offset = "0";
+            };
+            struct attr_t{
+                enum kind_t{
+                    STATIC,     //Copied as it is
+                    VALUE,      //`value.src.xxx`, the value of an expression as attribute `xxx`
+                    CYCLE,      //One attribute for each entry of a collection, in place of the first prop of its cycle
+                    UNKNOWN,    //Not a known command, reported while rendering
+                }kind;
+                pugi::xml_attribute attr;
+                const char* name;   //Name of the attribute in the output.
+                size_t cycle = 0;   //Index in `cycles`, only for CYCLE.
+            };
+            std::vector<attr_t> attrs;
+            std::vector<cycle_t> cycles;
+        };
+
+        //Information derived from the template once, and only read while rendering.
+        struct plan_t{
+            std::unordered_map<const pugi::xml_node_struct*,when_table_t> when;
+            //Roots of the largest subtrees with no namespace element or attribute.
+            std::unordered_map<const pugi::xml_node_struct*,static_t> static_subtrees;
+            //Plain elements with namespace props. Any other plain element only has attributes to copy.
+            std::unordered_map<const pugi::xml_node_struct*,props_t> props;
+        }plan;
+
+        //Build the plan for the current template and namespace.
+        void compile();
+        //Returns true if the subtree has no namespace content.
+        bool compile(const pugi::xml_node& node);
+
+        //Sort criteria of a cycle. Entries of `order_by` wrap around if fewer than those in `sort_by`.
+        static std::vector<std::pair<std::string,order_method_t::values>> make_criteria(const char* sort_by, const char* order_by);
+
+        //Sort out the attributes of a plain element, if any of them is a namespace prop.
+        void compile_props(const pugi::xml_node& node);
+
+        //Resolve expressions which do not depend on data or symbols.
+        static std::optional<concrete_symbol> resolve_literal(const char* str);
+
         //Transforming a string into a parsed symbol, setting an optional base root or leaving it to a default evaluation.
-        std::optional<concrete_symbol> resolve_expr(const std::string_view& str, const pugi::xml_node* base=nullptr) const;
+        std::optional<concrete_symbol> resolve_expr(const render_context& ctx, const std::string_view& str, const pugi::xml_node* base=nullptr) const;
 
-        std::vector<pugi::xml_attribute> prepare_props_data(const pugi::xml_node& base, int limit, int offset, bool(*filter)(const pugi::xml_attribute&), order_method_t::values criterion);
+        //Range of a prepared collection which a cycle iterates, after its `offset` and `limit`.
+        template<typename T>
+        struct window_t{
+            std::shared_ptr<const std::vector<T>> data;
+            size_t from = 0, to = 0;
 
-        std::vector<pugi::xml_node> prepare_children_data(const pugi::xml_node& base, int limit, int offset, bool(*filter)(const pugi::xml_node&), const std::vector<std::pair<std::string,order_method_t::values>>& criteria);
+            inline const T* begin() const{return data?data->data()+from:nullptr;}
+            inline const T* end() const{return data?data->data()+to:nullptr;}
+            inline size_t size() const{return to-from;}
 
-        void _parse(std::optional<pugi::xml_node_iterator> stop_at);
+            window_t() = default;
+            window_t(std::shared_ptr<const std::vector<T>>&& data, int limit, int offset);
+        };
 
-};
+        //Collections are prepared once per render for each data node and settings. Each call only picks its own window.
+        window_t<pugi::xml_attribute> prepare_props_data(render_context& ctx, const pugi::xml_node& base, int limit, int offset, bool(*filter)(const pugi::xml_attribute&), order_method_t::values criterion) const;
+
+        window_t<pugi::xml_node> prepare_children_data(render_context& ctx, const pugi::xml_node& base, int limit, int offset, bool(*filter)(const pugi::xml_node&), const std::vector<std::pair<std::string,order_method_t::values>>& criteria) const;
+
+        //Account for output written and check all budgets. Returns false once the render must stop.
+        bool charge(render_context& ctx, size_t nodes, size_t bytes) const;
+        //Account for one more iteration of a cycle. Returns false once the render must stop.
+        bool iterate(render_context& ctx) const;
+        void abort(render_context& ctx, abort_t::values reason) const;
+
+        //Write out the finished part of the output, or all of it if `final`.
+        void flush(render_context& ctx, bool final) const;
 
+        //Copy a plain element without its children, computing the attributes in `props` if any. Null once the render must stop.
+        pugi::xml_node append_element(render_context& ctx, pugi::xml_node& parent, const pugi::xml_node& node, const props_t* props) const;
+
+        void render(render_context& ctx, const pugi::xml_node& data, stream_buffer* out, size_t flush_every) const;
+
+        void _parse(render_context& ctx, std::optional<pugi::xml_node_iterator> stop_at) const;
+
+};
 
 }
 }
\ No newline at end of file
@@ -1,60 +1,231 @@
 /*
     CLI Usage:
-    vs.tmpl <template-file> <data-file> [namespace=`s:`]
+    vs.tmpl [options] <template-file> <data-file> [name=data-file ...] [namespace=`s:`]
 
     Unlike its usage in vs.fltk, template must be specified on its own.
+    Further data files can be given a name, to be used in expressions as `{name}/...`.
+    Names must be unique, and `$` is reserved for the main data file.
 
     Alternative
 
-    vs.tmpl [namespace=`s:`]
-    
+    vs.tmpl [options] [namespace=`s:`]
+
     with both files added via pipes, like `vs.tmpl <(cat template.xml) <(cat data.xml)
+
+    Options to limit the resources a render can use (0 for unlimited):
+    --max-nodes=N --max-bytes=N --max-iterations=N --max-depth=N --timeout=MS
+
+    Options to reuse renders of identical inputs, stored in a directory capped to a size in bytes:
+    --cache=DIR --cache-size=N
 */
 
 #include <pugixml.hpp>
 #include <vs-templ.hpp>
+#include <cache.hpp>
 
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace vs::templ;
 
-//TODO: Support error logging on std::cerr. Maybe use VS_VERBOSE env variable to determine what is shown and if.
+static void usage(const char* name){
+    std::cerr<<"Wrong usage:\n\t"<<name<<" [options] <template-file> <data-file> [name=data-file ...] [namespace=`s:`]\nOR\t "<<name<<" [options] [namespace=`s:`] and two input streams\n";
+    std::cerr<<"Options:\n\t--max-nodes=N --max-bytes=N --max-iterations=N --max-depth=N --timeout=MS\n\t--cache=DIR --cache-size=N\n";
+    exit(1);
+}
+
+//Parse the numeric value of a `--name=value` flag, if `arg` is that flag.
+static bool flag_value(const char* arg, const char* name, size_t& value){
+    size_t len = strlen(name);
+    if(strncmp(arg,name,len)!=0 || arg[len]!='=')return false;
+    char* end;
+    value = strtoull(arg+len+1,&end,10);
+    if(*end!=0 || arg[len+1]==0){std::cerr<<"Invalid value for "<<name<<"\n";exit(1);}
+    return true;
+}
+
+//Get the value of a `--name=value` flag, if `arg` is that flag.
+static bool flag_string(const char* arg, const char* name, const char*& value){
+    size_t len = strlen(name);
+    if(strncmp(arg,name,len)!=0 || arg[len]!='=')return false;
+    value = arg+len+1;
+    return true;
+}
+
+static bool read_all(std::istream& in, std::string& bytes){
+    bytes.assign(std::istreambuf_iterator<char>(in),std::istreambuf_iterator<char>());
+    return !in.bad();
+}
+
+//Content of an input. Regular files are mapped copy-on-write, so that pugixml can parse them in place. Anything else is read.
+struct input_t{
+    private:
+        char* map = nullptr;
+        size_t map_size = 0;
+        std::string bytes;
+
+    public:
+        input_t() = default;
+        input_t(const input_t&) = delete;
+        inline ~input_t(){if(map!=nullptr)munmap(map,map_size);}
+
+        bool open(const char* path){
+            int fd = ::open(path,O_RDONLY);
+            if(fd<0)return false;
+            struct stat info;
+            if(fstat(fd,&info)==0 && S_ISREG(info.st_mode) && info.st_size>0){
+                void* ptr = mmap(nullptr,info.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+                if(ptr!=MAP_FAILED){map=(char*)ptr;map_size=info.st_size;close(fd);return true;}
+            }
+            close(fd);
+            std::ifstream file(path,std::ios::binary);
+            return file && read_all(file,bytes);
+        }
+
+        inline bool open(std::istream& in){return read_all(in,bytes);}
+
+        inline char* data(){return map!=nullptr?map:bytes.data();}
+        inline size_t size() const{return map!=nullptr?map_size:bytes.size();}
+        inline std::string_view view() const{return map!=nullptr?std::string_view(map,map_size):std::string_view(bytes);}
+
+        //Parsing in place changes the buffer, so any hashing must come first.
+        inline pugi::xml_parse_result load(pugi::xml_document& doc){return doc.load_buffer_inplace(data(),size());}
+};
+
+//Minimum level of the log entries shown on std::cerr, from the VS_VERBOSE env variable. Errors and panics by default.
+static int verbosity(){
+    const char* env = getenv("VS_VERBOSE");
+    if(env==nullptr || env[0]==0)return log_t::ERROR;
+    for(int i=0;i<log_t::LEVELS;i++){
+        if(strcmp(env,log_t::to_string((log_t::values)i))==0)return i;
+    }
+    if(strcmp(env,"silent")==0)return log_t::LEVELS;
+    std::cerr<<"Unknown VS_VERBOSE level `"<<env<<"`, expected one of info, warning, error, panic, silent\n";
+    return log_t::ERROR;
+}
+
 int main(int argc, const char* argv[]){
+    int min_level = verbosity();
     const char* ns_prefix="s:";
-    if(argc==0 || argc > 4){
-        std::cerr<<"Wrong usage:\n\t"<<argv[0]<<" <template-file> <data-file> [namespace=`s:`]\nOR\t "<<argv[0]<<"[namespace=`s:`] and two input streams\n";
-        exit(1);
+    uint64_t seed = 0;
+    limits_t limits;
+    const char* cache_dir = nullptr;
+    size_t cache_size = 64*1024*1024;
+    std::vector<const char*> args;
+    std::vector<std::pair<std::string_view,const char*>> named;
+
+    for(int i=1;i<argc;i++){
+        size_t tmp;
+        if(flag_value(argv[i],"--max-nodes",limits.max_nodes)){}
+        else if(flag_value(argv[i],"--max-bytes",limits.max_bytes)){}
+        else if(flag_value(argv[i],"--max-iterations",limits.max_iterations)){}
+        else if(flag_value(argv[i],"--max-depth",limits.max_depth)){}
+        else if(flag_value(argv[i],"--timeout",tmp)){limits.deadline=std::chrono::milliseconds(tmp);}
+        else if(flag_string(argv[i],"--cache",cache_dir)){}
+        else if(flag_value(argv[i],"--cache-size",cache_size)){}
+        else if(strncmp(argv[i],"--",2)==0)usage(argv[0]);
+        //`name=file`, as long as the name could not be part of a path.
+        else if(const char* sep = strchr(argv[i],'='); sep!=nullptr && sep!=argv[i] && strcspn(argv[i],"/.")>(size_t)(sep-argv[i])){
+            //`$` is the main data root, and a name can only stand for one root.
+            std::string_view name(argv[i],sep-argv[i]);
+            if(name=="$"){std::cerr<<"The data root name `$` is reserved\n";exit(1);}
+            for(auto& other : named){
+                if(other.first==name){std::cerr<<"Data root `"<<name<<"` given more than once\n";exit(1);}
+            }
+            named.emplace_back(name,sep+1);
+        }
+        else args.push_back(argv[i]);
     }
 
-    pugi::xml_document data, tmpl;
+    if(args.size() > 3){
+        usage(argv[0]);
+    }
+
+    input_t tmpl_input, data_input;
+    std::deque<input_t> named_inputs;
 
-    if(argc>=2){
-        {auto t = tmpl.load_file(argv[1]); if(!t){std::cerr<<t.description()<<" @ `template file`\n";exit(2);}}
-        {auto t = data.load_file(argv[2]); if(!t){std::cerr<<t.description()<<" @ `data file`\n";exit(3);}}
+    if(args.size()>=2){
+        if(!tmpl_input.open(args[0])){std::cerr<<"File could not be read @ `template file`\n";exit(2);}
+        if(!data_input.open(args[1])){std::cerr<<"File could not be read @ `data file`\n";exit(3);}
 
-        if(argc>=4){ns_prefix=argv[3];}
-        if(argc>=5){/*TODO: process random seed*/}
+        if(args.size()>=3){ns_prefix=args[2];}
+        //TODO: process random seed
     }
     else{
-        if(argc==2){ns_prefix=argv[1];}
+        if(args.size()==1){ns_prefix=args[0];}
+
+        if(!tmpl_input.open(std::cin)){std::cerr<<"File could not be read @ `template file`\n";exit(2);}
+        if(!data_input.open(std::cin)){std::cerr<<"File could not be read @ `data file`\n";exit(3);}
+    }
+
+    for(auto& [name,path] : named){
+        if(!named_inputs.emplace_back().open(path)){std::cerr<<"File could not be read @ `"<<name<<" data file`\n";exit(3);}
+    }
 
-        {auto t = tmpl.load(std::cin); if(!t){std::cerr<<t.description()<<" @ `template file`\n";exit(2);}}
-        {auto t = data.load(std::cin); if(!t){std::cerr<<t.description()<<" @ `data file`\n";exit(3);}}
+    //On a hit, the stored output is copied straight to stdout, with no parsing or rendering.
+    std::optional<render_cache> cache;
+    std::string key;
+    if(cache_dir!=nullptr){
+        cache.emplace(cache_dir,cache_size);
+        std::string options = std::to_string(seed)+" "+std::to_string(min_level)+" "+
+            std::to_string(limits.max_nodes)+" "+std::to_string(limits.max_bytes)+" "+std::to_string(limits.max_iterations)+" "+
+            std::to_string(limits.max_depth)+" "+std::to_string(limits.deadline.count())+" "+std::to_string(limits.discard_partial);
+        std::vector<std::string_view> parts = {tmpl_input.view(),data_input.view(),ns_prefix,options};
+        for(size_t i=0;i<named.size();i++){parts.push_back(named[i].first);parts.push_back(named_inputs[i].view());}
+        key = render_cache::key(parts);
+        std::string logs;
+        if(cache->fetch(key,STDOUT_FILENO,&logs)){
+            std::cerr<<logs;
+            return 0;
+        }
+    }
 
+    pugi::xml_document data, tmpl;
+    std::deque<pugi::xml_document> named_docs;
+    {auto t = tmpl_input.load(tmpl); if(!t){std::cerr<<t.description()<<" @ `template file`\n";exit(2);}}
+    {auto t = data_input.load(data); if(!t){std::cerr<<t.description()<<" @ `data file`\n";exit(3);}}
+    for(size_t i=0;i<named.size();i++){
+        auto t = named_inputs[i].load(named_docs.emplace_back());
+        if(!t){std::cerr<<t.description()<<" @ `"<<named[i].first<<" data file`\n";exit(3);}
     }
 
-    preprocessor doc(data,tmpl,ns_prefix);
+    preprocessor doc(data,tmpl,ns_prefix,seed);
+    for(size_t i=0;i<named.size();i++)doc.add_data(named[i].first,named_docs[i]);
+    doc.limits(limits);
+    if(min_level<log_t::LEVELS)doc.configure_logs(256,(log_t::values)min_level);
     auto& result = doc.parse();
 
-    
-    for(auto& log : doc.logs()){
-        if(log.type()==log_t::values::ERROR){
-            std::cerr<<log.description()<<"\n";
+    std::stringstream logs;
+    if(min_level<log_t::LEVELS){
+        for(auto& log : doc.logs()){
+            logs<<"["<<log_t::to_string(log.type())<<"] "<<log.description()<<"\n";
         }
+        if(doc.logs().dropped()>0)logs<<doc.logs().dropped()<<" more log entries were not retained\n";
     }
-    
-
-    result.save(std::cout);
+    std::cerr<<logs.str();
+
+    //Aborted renders are not stored, as they might depend on timing.
+    if(cache.has_value() && doc.aborted()==abort_t::NONE){
+        std::stringstream output;
+        result.save(output);
+        std::string bytes = output.str();
+        std::cout<<bytes;
+        cache->store(key,bytes,logs.str());
+    }
+    else result.save(std::cout);
 
-    return 0;
-}
\ No newline at end of file
+    return doc.aborted()==abort_t::NONE?0:4;
+}
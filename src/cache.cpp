@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+#include <sha256.h>
+
+#include <cache.hpp>
+
+#ifndef VS_TEMPL_VERSION
+#define VS_TEMPL_VERSION "unknown"
+#endif
+
+namespace vs{
+namespace templ{
+
+namespace fs = std::filesystem;
+
+//Copy `size` bytes from the start of `in` to `out`, in kernel space where supported.
+static bool copy_fd(int in, int out, size_t size){
+#if defined(__linux__)
+    off_t offset = 0;
+    while((size_t)offset<size){
+        if(sendfile(out,in,&offset,size-offset)<=0)break;
+    }
+    if((size_t)offset==size)return true;
+    //Some bytes are out already, falling back would duplicate them.
+    if(offset!=0)return false;
+#endif
+    if(size==0)return true;
+    void* map = mmap(nullptr,size,PROT_READ,MAP_PRIVATE,in,0);
+    if(map==MAP_FAILED)return false;
+    size_t done = 0;
+    while(done<size){
+        ssize_t n = write(out,(const char*)map+done,size-done);
+        if(n<=0)break;
+        done+=n;
+    }
+    munmap(map,size);
+    return done==size;
+}
+
+//Suffix of files being written, which are not part of any entry yet.
+static constexpr const char* TMP_SUFFIX = ".tmp.XXXXXX";
+
+//Left over files older than this are assumed to belong to writers which died, and are removed on eviction.
+static constexpr auto STALE_AFTER = std::chrono::minutes(1);
+
+//Whether a file name starts with a key as made by `render_cache::key`, 64 hex digits. Only those files are ours.
+static bool has_key(std::string_view name){
+    if(name.size()<64)return false;
+    for(size_t i=0;i<64;i++){
+        if(!((name[i]>='0' && name[i]<='9') || (name[i]>='a' && name[i]<='f')))return false;
+    }
+    return true;
+}
+
+//Write to a temporary file first, so that concurrent readers never see a partial entry.
+//Its name is unique, even across threads writing the same key.
+static bool write_file(const fs::path& target, std::string_view content){
+    std::string tmp = target.string()+TMP_SUFFIX;
+    int fd = mkstemp(tmp.data());
+    if(fd<0)return false;
+    size_t done = 0;
+    while(done<content.size()){
+        ssize_t n = write(fd,content.data()+done,content.size()-done);
+        if(n<=0)break;
+        done+=n;
+    }
+    bool ok = close(fd)==0 && done==content.size();
+    std::error_code ec;
+    if(ok)fs::rename(tmp,target,ec);
+    if(!ok || ec){fs::remove(tmp,ec);return false;}
+    return true;
+}
+
+render_cache::render_cache(const fs::path& dir, size_t max_size):dir(dir),max_size(max_size){
+    std::error_code ec;
+    fs::create_directories(dir,ec);
+}
+
+fs::path render_cache::path(const std::string& key, const char* ext) const{
+    return dir/(key+ext);
+}
+
+std::string render_cache::key(const std::vector<std::string_view>& parts){
+    SHA256 hash;
+    //Each part is prefixed by its length, so that moving bytes from one part to the next changes the key.
+    auto add = [&](std::string_view str){
+        uint64_t len = str.size();
+        hash.add(&len,sizeof(len));
+        hash.add(str.data(),str.size());
+    };
+    add(VS_TEMPL_VERSION);
+    for(auto& part : parts)add(part);
+    return hash.getHash();
+}
+
+bool render_cache::fetch(const std::string& key, int fd, std::string* logs) const{
+    auto output = path(key,".xml");
+    int in = open(output.c_str(),O_RDONLY);
+    if(in<0)return false;
+
+    struct stat info;
+    if(fstat(in,&info)!=0){close(in);return false;}
+
+    if(logs!=nullptr){
+        std::ifstream file(path(key,".log"),std::ios::binary);
+        if(!file){close(in);return false;}
+        logs->assign(std::istreambuf_iterator<char>(file),std::istreambuf_iterator<char>());
+    }
+
+    bool ret = copy_fd(in,fd,info.st_size);
+    close(in);
+
+    //Mark the entry as recently used.
+    if(ret){
+        std::error_code ec;
+        fs::last_write_time(output,fs::file_time_type::clock::now(),ec);
+    }
+    return ret;
+}
+
+void render_cache::store(const std::string& key, std::string_view output, std::string_view logs){
+    //Logs go first, an entry is only visible once its output is there.
+    if(!write_file(path(key,".log"),logs))return;
+    if(!write_file(path(key,".xml"),output))return;
+    evict();
+}
+
+void render_cache::evict(){
+    struct entry_t{
+        fs::path output;
+        fs::file_time_type used;
+        size_t size;
+    };
+
+    std::vector<entry_t> entries;
+    size_t total = 0;
+    std::error_code ec;
+    auto stale = fs::file_time_type::clock::now()-STALE_AFTER;
+    for(auto& file : fs::directory_iterator(dir,ec)){
+        size_t size = file.file_size(ec);
+        if(ec)continue;
+        auto time = file.last_write_time(ec);
+        if(ec)continue;
+
+        //Anything else in the directory is not ours to touch.
+        std::string name = file.path().filename().string();
+        if(!has_key(name))continue;
+        std::string_view ext = std::string_view(name).substr(64);
+
+        if(ext==".xml"){
+            auto logs = file.path();
+            logs.replace_extension(".log");
+            size_t logs_size = fs::file_size(logs,ec);
+            entries.push_back({file.path(),time,size+(ec?0:logs_size)});
+            total+=entries.back().size;
+        }
+        else if(ext==".log"){
+            //Logs are counted with their output. Those without one are from interrupted writes.
+            auto output = file.path();
+            output.replace_extension(".xml");
+            if(fs::exists(output,ec))continue;
+            if(time<stale)fs::remove(file.path(),ec);
+            else total+=size;
+        }
+        //Temporary files of either part of an entry.
+        else if(ext.size()==4+std::char_traits<char>::length(TMP_SUFFIX) && (ext.starts_with(".xml.tmp.") || ext.starts_with(".log.tmp."))){
+            if(time<stale)fs::remove(file.path(),ec);
+            else total+=size;
+        }
+    }
+    if(total<=max_size)return;
+
+    std::sort(entries.begin(),entries.end(),[](const entry_t& a, const entry_t& b){return a.used<b.used;});
+    for(auto& entry : entries){
+        if(total<=max_size)break;
+        fs::remove(entry.output,ec);
+        entry.output.replace_extension(".log");
+        fs::remove(entry.output,ec);
+        total-=entry.size;
+    }
+}
+
+}
+}
@@ -0,0 +1,44 @@
+#include <logging.hpp>
+
+namespace vs{
+namespace templ{
+
+static std::string arg_to_string(const log_t::arg_t& arg){
+    if(std::holds_alternative<int64_t>(arg))return std::to_string(std::get<int64_t>(arg));
+    else if(std::holds_alternative<const char*>(arg))return std::get<const char*>(arg);
+    else return "";
+}
+
+std::string log_t::description() const{
+    std::string msg;
+    switch(_code){
+        case UNKNOWN_OPERATION:
+            msg = "unrecognized static operation `"+arg_to_string(_args[0])+"`";
+            break;
+        case UNKNOWN_PROP_OPERATION:
+            msg = "unrecognized static operation on attribute `"+arg_to_string(_args[0])+"`";
+            break;
+        case RENDER_ABORTED:
+            msg = "render aborted, budget exceeded: "+arg_to_string(_args[0]);
+            break;
+        case RENDER_CANCELLED:
+            msg = "render cancelled by its consumer";
+            break;
+    }
+    if(_node>=0)msg+=" @ "+std::to_string(_node);
+    return msg;
+}
+
+const char* log_t::to_string(values v){
+    switch(v){
+        case INFO: return "info";
+        case WARNING: return "warning";
+        case ERROR: return "error";
+        case PANIC: return "panic";
+        case LEVELS: break;
+    }
+    return "unknown";
+}
+
+}
+}
@@ -0,0 +1,135 @@
+#include <cstring>
+
+#include <registry.hpp>
+
+namespace vs{
+namespace templ{
+
+namespace fs = std::filesystem;
+
+//Nodes and attributes are small structs of pointers in pugixml, and their strings live in the parsed buffer.
+static size_t tree_cost(const pugi::xml_node& node){
+    size_t ret = 8*sizeof(void*)+strlen(node.name())+strlen(node.value());
+    for(const auto& attr : node.attributes())ret+=5*sizeof(void*)+strlen(attr.name())+strlen(attr.value());
+    for(const auto& child : node.children())ret+=tree_cost(child);
+    return ret;
+}
+
+compiled_template::compiled_template(const fs::path& path, const char* prefix, uint64_t seed, const limits_t& limits):_processor({},{},prefix,seed){
+    compile(doc.load_file(path.c_str()),prefix,seed,limits);
+}
+
+compiled_template::compiled_template(std::string_view source, const char* prefix, uint64_t seed, const limits_t& limits):_processor({},{},prefix,seed){
+    compile(doc.load_buffer(source.data(),source.size()),prefix,seed,limits);
+}
+
+void compiled_template::compile(const pugi::xml_parse_result& result, const char* prefix, uint64_t seed, const limits_t& limits){
+    _ok = result.status==pugi::status_ok;
+    if(!_ok){doc.reset();return;}
+    _processor.init({},doc,prefix,seed);
+    _processor.limits(limits);
+    _cost = sizeof(*this)+tree_cost(doc);
+}
+
+abort_t::values compiled_template::render(const pugi::xml_node& data, pugi::xml_writer& sink) const{
+    render_context ctx;
+    _processor.render(ctx,data);
+    ctx.result().save(sink);
+    return ctx.aborted();
+}
+
+std::shared_ptr<const compiled_template> template_registry::lookup(std::string_view key, const std::optional<fs::file_time_type>& mtime){
+    std::lock_guard lock(mtx);
+    auto it = entries.find(key);
+    if(it==entries.end()){_stats.misses++;return nullptr;}
+    if(mtime.has_value() && it->second.mtime!=mtime){
+        drop(it);
+        _stats.reloads++;
+        _stats.misses++;
+        return nullptr;
+    }
+    lru.splice(lru.begin(),lru,it->second.used);
+    _stats.hits++;
+    return it->second.value;
+}
+
+std::shared_ptr<const compiled_template> template_registry::insert(std::string_view key, std::shared_ptr<const compiled_template>&& value, const std::optional<fs::file_time_type>& mtime){
+    std::lock_guard lock(mtx);
+    //Another thread might have compiled the same template in the meanwhile.
+    if(auto it = entries.find(key); it!=entries.end()){
+        if(!mtime.has_value() || it->second.mtime==mtime){
+            lru.splice(lru.begin(),lru,it->second.used);
+            return it->second.value;
+        }
+        drop(it);
+    }
+
+    lru.emplace_front(key);
+    _stats.cost+=value->cost();
+    auto& entry = entries.emplace(lru.front(),entry_t{std::move(value),mtime,lru.begin()}).first->second;
+
+    //The newest entry is kept even if it is larger than the whole budget on its own.
+    while(_stats.cost>options.max_cost && lru.size()>1){
+        drop(entries.find(lru.back()));
+        _stats.evictions++;
+    }
+    return entry.value;
+}
+
+void template_registry::drop(decltype(entries)::iterator it){
+    _stats.cost-=it->second.value->cost();
+    lru.erase(it->second.used);
+    entries.erase(it);
+}
+
+std::shared_ptr<const compiled_template> template_registry::get(const std::string& path){
+    std::optional<fs::file_time_type> mtime;
+    if(options.check_mtime){
+        std::error_code ec;
+        auto time = fs::last_write_time(path,ec);
+        if(!ec)mtime = time;
+    }
+    if(auto ret = lookup(path,mtime); ret!=nullptr)return ret;
+
+    auto value = std::make_shared<const compiled_template>(fs::path(path),options.prefix,options.seed,options.limits);
+    if(!value->ok()){
+        std::lock_guard lock(mtx);
+        _stats.failures++;
+        return nullptr;
+    }
+    return insert(path,std::move(value),mtime);
+}
+
+std::shared_ptr<const compiled_template> template_registry::get(std::string_view key, std::string_view source){
+    if(auto ret = lookup(key,{}); ret!=nullptr)return ret;
+
+    auto value = std::make_shared<const compiled_template>(source,options.prefix,options.seed,options.limits);
+    if(!value->ok()){
+        std::lock_guard lock(mtx);
+        _stats.failures++;
+        return nullptr;
+    }
+    return insert(key,std::move(value),{});
+}
+
+void template_registry::erase(std::string_view key){
+    std::lock_guard lock(mtx);
+    if(auto it = entries.find(key); it!=entries.end())drop(it);
+}
+
+void template_registry::clear(){
+    std::lock_guard lock(mtx);
+    entries.clear();
+    lru.clear();
+    _stats.cost=0;
+}
+
+template_registry::stats_t template_registry::stats() const{
+    std::lock_guard lock(mtx);
+    stats_t ret = _stats;
+    ret.entries = entries.size();
+    return ret;
+}
+
+}
+}
@@ -0,0 +1,128 @@
+#include <cstdint>
+
+#include <scan.hpp>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#   include <immintrin.h>
+#   define VS_TEMPL_SCAN_X86
+#   define VS_TEMPL_SCAN_AVX2
+#endif
+
+namespace vs{
+namespace templ{
+
+static inline bool needs_escape(unsigned char c, bool attribute){
+    if(c=='&' || c=='<' || c=='>')return true;
+    if(c<32)return attribute || (c!='\t' && c!='\n' && c!='\r');
+    return attribute && c=='"';
+}
+
+static size_t find_any_scalar(const char* str, size_t len, char a, char b){
+    for(size_t i=0;i<len;i++){
+        if(str[i]==a || str[i]==b)return i;
+    }
+    return len;
+}
+
+static size_t find_escape_scalar(const char* str, size_t len, bool attribute){
+    for(size_t i=0;i<len;i++){
+        if(needs_escape(str[i],attribute))return i;
+    }
+    return len;
+}
+
+static const scan_kernels_t scalar_kernels{"scalar",find_any_scalar,find_escape_scalar};
+
+#if defined(VS_TEMPL_SCAN_X86)
+
+static size_t find_any_sse2(const char* str, size_t len, char a, char b){
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    size_t i = 0;
+    for(;i+16<=len;i+=16){
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(str+i));
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk,va),_mm_cmpeq_epi8(chunk,vb)));
+        if(mask!=0)return i+__builtin_ctz(mask);
+    }
+    return i+find_any_scalar(str+i,len-i,a,b);
+}
+
+static size_t find_escape_sse2(const char* str, size_t len, bool attribute){
+    const __m128i amp = _mm_set1_epi8('&'), lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>');
+    const __m128i quot = _mm_set1_epi8(attribute?'"':'&');
+    const __m128i ctrl = _mm_set1_epi8(31);
+    const __m128i tab = _mm_set1_epi8(attribute?'&':'\t'), nl = _mm_set1_epi8(attribute?'&':'\n'), cr = _mm_set1_epi8(attribute?'&':'\r');
+    size_t i = 0;
+    for(;i+16<=len;i+=16){
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(str+i));
+        //Unsigned c<=31, as max(c,31)==31
+        __m128i special = _mm_cmpeq_epi8(_mm_max_epu8(chunk,ctrl),ctrl);
+        special = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk,tab),_mm_or_si128(_mm_cmpeq_epi8(chunk,nl),_mm_cmpeq_epi8(chunk,cr))),special);
+        special = _mm_or_si128(special,_mm_or_si128(_mm_cmpeq_epi8(chunk,amp),_mm_cmpeq_epi8(chunk,quot)));
+        special = _mm_or_si128(special,_mm_or_si128(_mm_cmpeq_epi8(chunk,lt),_mm_cmpeq_epi8(chunk,gt)));
+        unsigned mask = _mm_movemask_epi8(special);
+        if(mask!=0)return i+__builtin_ctz(mask);
+    }
+    return i+find_escape_scalar(str+i,len-i,attribute);
+}
+
+static const scan_kernels_t sse2_kernels{"sse2",find_any_sse2,find_escape_sse2};
+
+#endif
+
+#if defined(VS_TEMPL_SCAN_AVX2)
+
+__attribute__((target("avx2"))) static size_t find_any_avx2(const char* str, size_t len, char a, char b){
+    const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    size_t i = 0;
+    for(;i+32<=len;i+=32){
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(str+i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk,va),_mm256_cmpeq_epi8(chunk,vb)));
+        if(mask!=0)return i+__builtin_ctz(mask);
+    }
+    return i+find_any_sse2(str+i,len-i,a,b);
+}
+
+__attribute__((target("avx2"))) static size_t find_escape_avx2(const char* str, size_t len, bool attribute){
+    const __m256i amp = _mm256_set1_epi8('&'), lt = _mm256_set1_epi8('<'), gt = _mm256_set1_epi8('>');
+    const __m256i quot = _mm256_set1_epi8(attribute?'"':'&');
+    const __m256i ctrl = _mm256_set1_epi8(31);
+    const __m256i tab = _mm256_set1_epi8(attribute?'&':'\t'), nl = _mm256_set1_epi8(attribute?'&':'\n'), cr = _mm256_set1_epi8(attribute?'&':'\r');
+    size_t i = 0;
+    for(;i+32<=len;i+=32){
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(str+i));
+        __m256i special = _mm256_cmpeq_epi8(_mm256_max_epu8(chunk,ctrl),ctrl);
+        special = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk,tab),_mm256_or_si256(_mm256_cmpeq_epi8(chunk,nl),_mm256_cmpeq_epi8(chunk,cr))),special);
+        special = _mm256_or_si256(special,_mm256_or_si256(_mm256_cmpeq_epi8(chunk,amp),_mm256_cmpeq_epi8(chunk,quot)));
+        special = _mm256_or_si256(special,_mm256_or_si256(_mm256_cmpeq_epi8(chunk,lt),_mm256_cmpeq_epi8(chunk,gt)));
+        unsigned mask = _mm256_movemask_epi8(special);
+        if(mask!=0)return i+__builtin_ctz(mask);
+    }
+    return i+find_escape_sse2(str+i,len-i,attribute);
+}
+
+static const scan_kernels_t avx2_kernels{"avx2",find_any_avx2,find_escape_avx2};
+
+#endif
+
+const scan_kernels_t& scan_kernels(){
+    static const scan_kernels_t& best = []() -> const scan_kernels_t&{
+        auto all = scan_all_kernels();
+        return *all.back();
+    }();
+    return best;
+}
+
+std::vector<const scan_kernels_t*> scan_all_kernels(){
+    std::vector<const scan_kernels_t*> ret{&scalar_kernels};
+#if defined(VS_TEMPL_SCAN_X86)
+    //Always available on x86-64
+    ret.push_back(&sse2_kernels);
+#endif
+#if defined(VS_TEMPL_SCAN_AVX2)
+    if(__builtin_cpu_supports("avx2"))ret.push_back(&avx2_kernels);
+#endif
+    return ret;
+}
+
+}
+}
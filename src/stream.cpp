@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <thread>
+
+#include <scan.hpp>
+#include <stream.hpp>
+
+namespace vs{
+namespace templ{
+
+bool stream_buffer::write(std::string_view bytes){
+    std::unique_lock lock(mtx);
+    //Large writes, like whole subtrees, are queued a piece at a time so that the buffer never goes over its bound.
+    while(!bytes.empty()){
+        cv.wait(lock,[&]{return cancelled || data.size()<max_buffered;});
+        if(cancelled)return false;
+        size_t n = std::min(bytes.size(),max_buffered-data.size());
+        data.append(bytes.substr(0,n));
+        bytes.remove_prefix(n);
+        cv.notify_all();
+    }
+    return true;
+}
+
+void stream_buffer::close(){
+    std::lock_guard lock(mtx);
+    closed=true;
+    cv.notify_all();
+}
+
+bool stream_buffer::read(std::string& chunk, size_t size){
+    std::unique_lock lock(mtx);
+    cv.wait(lock,[&]{return closed || data.size()>=size;});
+    if(data.empty())return false;
+    size_t n = std::min(size,data.size());
+    chunk.assign(data,0,n);
+    data.erase(0,n);
+    cv.notify_all();
+    return true;
+}
+
+void stream_buffer::cancel(){
+    std::lock_guard lock(mtx);
+    cancelled=true;
+    cv.notify_all();
+}
+
+//Same escaping pugixml applies, with runs of plain bytes found by the scan kernels.
+static void write_escaped(std::string& out, const char* str, bool attribute){
+    auto& scan = scan_kernels();
+    size_t len = strlen(str);
+    for(;;){
+        size_t n = scan.find_escape(str,len,attribute);
+        out.append(str,n);
+        if(n==len)return;
+        switch(str[n]){
+            case '&': out+="&amp;"; break;
+            case '<': out+="&lt;"; break;
+            case '>': out+="&gt;"; break;
+            case '"': out+="&quot;"; break;
+            default: out+="&#";out+=std::to_string((int)str[n]);out+=';';
+        }
+        str+=n+1;
+        len-=n+1;
+    }
+}
+
+static void write_attributes(std::string& out, const pugi::xml_node& node){
+    for(const auto& attr : node.attributes()){
+        out+=' ';
+        out+=attr.name();
+        out+="=\"";
+        write_escaped(out,attr.value(),true);
+        out+='"';
+    }
+}
+
+static void write_start(std::string& out, const pugi::xml_node& node){
+    out+='<';
+    out+=node.name();
+    write_attributes(out,node);
+    out+='>';
+}
+
+//Serialize a whole subtree, like pugixml does with `format_raw`. Placeholders are replaced by the data subtree they stand for.
+static void write_node(std::string& out, const pugi::xml_node& node, splices_t& spliced){
+    switch(node.type()){
+        case pugi::node_document:
+            for(const auto& child : node.children())write_node(out,child,spliced);
+            break;
+        case pugi::node_element:
+            out+='<';
+            out+=node.name();
+            write_attributes(out,node);
+            if(!node.first_child()){out+="/>";break;}
+            out+='>';
+            for(const auto& child : node.children())write_node(out,child,spliced);
+            out+="</";
+            out+=node.name();
+            out+='>';
+            break;
+        case pugi::node_pcdata:
+            write_escaped(out,node.value(),false);
+            break;
+        case pugi::node_cdata:{
+            //`]]>` cannot appear within a CDATA section, it is split across two of them.
+            std::string_view value = node.value();
+            out+="<![CDATA[";
+            for(size_t pos; (pos=value.find("]]>"))!=std::string_view::npos; value.remove_prefix(pos+2)){
+                out.append(value.substr(0,pos+2));
+                out+="]]><![CDATA[";
+            }
+            out.append(value);
+            out+="]]>";
+            break;
+        }
+        case pugi::node_comment:
+            out+="<!--";
+            out+=node.value();
+            out+="-->";
+            break;
+        case pugi::node_pi:
+            if(!spliced.empty()){
+                if(auto it = spliced.find(node.internal_object()); it!=spliced.end()){
+                    auto data = it->second;
+                    spliced.erase(it);
+                    write_node(out,data,spliced);
+                    break;
+                }
+            }
+            out+="<?";
+            out+=node.name();
+            if(node.value()[0]!=0){out+=' ';out+=node.value();}
+            out+="?>";
+            break;
+        case pugi::node_declaration:
+            out+="<?";
+            out+=node.name();
+            write_attributes(out,node);
+            out+="?>";
+            break;
+        case pugi::node_doctype:
+            out+="<!DOCTYPE ";
+            out+=node.value();
+            out+='>';
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+    Nodes are only ever appended as the last child of the element being filled, so everything but the last child
+    at each level is final. Those are printed and removed. The last child, if an element, gets its start tag written
+    and the same happens within it. Once a node is not the last one anymore, or at the end, the rest is written.
+*/
+static void write_children(std::vector<pugi::xml_node>& opened, splices_t& spliced, std::string& out, pugi::xml_node parent, size_t depth, bool final){
+    for(auto child = parent.first_child(); child;){
+        bool started = depth<opened.size() && opened[depth]==child;
+        if(!final && child==parent.last_child()){
+            if(child.type()==pugi::node_element){
+                if(!started){write_start(out,child);opened.push_back(child);}
+                write_children(opened,spliced,out,child,depth+1,false);
+            }
+            return;
+        }
+        if(started){
+            write_children(opened,spliced,out,child,depth+1,true);
+            out+="</";
+            out+=child.name();
+            out+='>';
+            opened.resize(depth);
+        }
+        else write_node(out,child,spliced);
+        auto next = child.next_sibling();
+        parent.remove_child(child);
+        child = next;
+    }
+}
+
+void preprocessor::flush(render_context& ctx, bool final) const{
+    write_children(ctx.opened,ctx.spliced,ctx.pending,ctx.compiled,0,final);
+    ctx.flushed_bytes=ctx.used_bytes;
+    if(ctx.pending.empty())return;
+    if(!ctx._stream->write(ctx.pending))abort(ctx,abort_t::CANCELLED);
+    ctx.pending.clear();
+}
+
+chunk_generator render_chunks(const preprocessor& doc, render_context& ctx, stream_options_t options){
+    //A buffer smaller than a chunk would never fill one.
+    stream_buffer buffer(std::max(options.max_buffered,options.chunk_size));
+    std::thread worker([&]{
+        doc.render(ctx,buffer,options.chunk_size);
+        buffer.close();
+    });
+
+    //If the generator is destroyed early, the render must be stopped before the thread can be joined.
+    struct guard_t{
+        stream_buffer& buffer;
+        std::thread& worker;
+        inline ~guard_t(){buffer.cancel();worker.join();}
+    }guard{buffer,worker};
+
+    std::string chunk;
+    while(buffer.read(chunk,options.chunk_size))co_yield std::string_view(chunk);
+}
+
+}
+}
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include <thread-pool.hpp>
+
+namespace vs{
+namespace templ{
+
+thread_pool::thread_pool(size_t threads){
+    workers.reserve(threads);
+    for(size_t i=0;i<threads;i++){
+        workers.emplace_back([this]{
+            for(;;){
+                std::function<void()> task;
+                {
+                    std::unique_lock lock(mtx);
+                    cv.wait(lock,[this]{return stopping || !tasks.empty();});
+                    if(tasks.empty())return;
+                    task=std::move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        });
+    }
+}
+
+thread_pool::~thread_pool(){
+    {
+        std::lock_guard lock(mtx);
+        stopping=true;
+    }
+    cv.notify_all();
+    for(auto& worker : workers)worker.join();
+}
+
+void thread_pool::parallel_for(size_t n, const std::function<void(size_t)>& fn){
+    if(n==0)return;
+
+    //Helpers can start after the call has returned. By then they find the state closed and leave without touching `fn`.
+    struct state_t{
+        std::atomic<size_t> next = 0;
+        size_t n;
+        const std::function<void(size_t)>* fn;
+        std::mutex mtx;
+        std::condition_variable cv;
+        size_t running = 0;
+        bool closed = false;
+    };
+    auto state = std::make_shared<state_t>();
+    state->n=n;
+    state->fn=&fn;
+
+    auto work = [](state_t& state){
+        for(size_t i;(i=state.next++)<state.n;)(*state.fn)(i);
+    };
+
+    size_t helpers = std::min(workers.size(),n-1);
+    if(helpers>0){
+        {
+            std::lock_guard lock(mtx);
+            for(size_t i=0;i<helpers;i++){
+                tasks.emplace_back([state,work]{
+                    {
+                        std::lock_guard lock(state->mtx);
+                        if(state->closed)return;
+                        state->running++;
+                    }
+                    work(*state);
+                    std::lock_guard lock(state->mtx);
+                    if(--state->running==0)state->cv.notify_all();
+                });
+            }
+        }
+        cv.notify_all();
+    }
+
+    work(*state);
+
+    std::unique_lock lock(state->mtx);
+    state->closed=true;
+    state->cv.wait(lock,[&]{return state->running==0;});
+}
+
+thread_pool& thread_pool::shared(){
+    static thread_pool pool(std::max(1u,std::thread::hardware_concurrency())-1);
+    return pool;
+}
+
+}
+}
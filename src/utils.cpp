@@ -1,3 +1,6 @@
+#include <charconv>
+#include <cmath>
+#include <scan.hpp>
 #include <utils.hpp>
 
 namespace vs{
@@ -6,27 +9,102 @@ namespace templ{
 
 std::vector<std::string_view> split_string (const char* str, char delim) {
     std::vector<std::string_view> result;
-    size_t i = 0, last = 0;
-    for(;; i++){
-        if(str[i]==delim){result.emplace_back(str+last,i-last);i++;last=i;}
-        if(str[i]==0){result.emplace_back(str+last,i-last);break;}
+    auto& scan = scan_kernels();
+    size_t len = strlen(str), last = 0;
+    for(;;){
+        size_t i = last+scan.find_any(str+last,len-last,delim,delim);
+        result.emplace_back(str+last,i-last);
+        if(i==len)break;
+        last=i+1;
     }
     return result;
 }
 
-int cmp_dot_str(const char* a, const char* b){
-    auto va = split_string(a, '.');
-    auto vb = split_string(b, '.');
+std::optional<number_t> parse_number(std::string_view str, bool partial){
+    const char* begin = str.data();
+    const char* end = str.data()+str.size();
+    if(begin!=end && *begin=='+')begin++;
+    if(begin==end)return {};
 
-    if(va.size()<vb.size())return -1;
-    else if(va.size()>vb.size())return 1;
+    int64_t i = 0;
+    auto [iptr, iec] = std::from_chars(begin,end,i);
+    if(iec==std::errc() && iptr==end)return i;
 
-    for(size_t i =0;i<va.size();i++){
-        if(va.at(i)<vb.at(i))return -1;
-        else if(va.at(i)>vb.at(i))return 1;
+    double d = 0;
+    auto [dptr, dec] = std::from_chars(begin,end,d);
+    //Infinities and NaNs are not numbers here, they would break any ordering of keys.
+    if(dec==std::errc() && !std::isfinite(d))return {};
+    if(dec==std::errc() && (dptr==end || partial)){
+        //Prefer the integer interpretation of prefixes like `12abc`
+        if(partial && iec==std::errc() && iptr==dptr)return i;
+        return d;
+    }
+    if(partial && iec==std::errc())return i;
+    return {};
+}
+
+int cmp_number(const number_t& a, const number_t& b){
+    if(std::holds_alternative<int64_t>(a) && std::holds_alternative<int64_t>(b)){
+        auto x = std::get<int64_t>(a), y = std::get<int64_t>(b);
+        return (x>y)-(x<y);
+    }
+    double x = std::holds_alternative<int64_t>(a)?(double)std::get<int64_t>(a):std::get<double>(a);
+    double y = std::holds_alternative<int64_t>(b)?(double)std::get<int64_t>(b):std::get<double>(b);
+    return (x>y)-(x<y);
+}
+
+number_t normalize_number(const number_t& n){
+    if(std::holds_alternative<double>(n)){
+        double d = std::get<double>(n);
+        if(d==0)return (int64_t)0;  //Both signs of zero
+        if(std::trunc(d)==d && d>=-9.2e18 && d<=9.2e18)return (int64_t)d;
+    }
+    return n;
+}
+
+std::string number_to_string(const number_t& n){
+    char buffer[32];
+    std::to_chars_result ret;
+    if(std::holds_alternative<int64_t>(n))ret = std::to_chars(buffer,buffer+sizeof(buffer),std::get<int64_t>(n));
+    else ret = std::to_chars(buffer,buffer+sizeof(buffer),std::get<double>(n));
+    return std::string(buffer,ret.ptr);
+}
+
+//Compare two segments, as delimited by cmp_dot_str
+static int cmp_segment(const char* a, size_t la, const char* b, size_t lb, bool natural){
+    if(natural){
+        bool na = la>0, nb = lb>0;
+        for(size_t i=0;i<la && na;i++)na=a[i]>='0' && a[i]<='9';
+        for(size_t i=0;i<lb && nb;i++)nb=b[i]>='0' && b[i]<='9';
+        if(na && nb){
+            //Skip leading zeros, then a longer number is bigger, else compare digits.
+            while(la>1 && a[0]=='0'){a++;la--;}
+            while(lb>1 && b[0]=='0'){b++;lb--;}
+            if(la!=lb)return la<lb?-1:1;
+            int cmp = memcmp(a,b,la);
+            return (cmp>0)-(cmp<0);
+        }
+        else if(na!=nb)return na?-1:1;
+    }
+    int cmp = memcmp(a,b,la<lb?la:lb);
+    if(cmp!=0)return (cmp>0)-(cmp<0);
+    return (la>lb)-(la<lb);
+}
+
+int cmp_dot_str(const char* a, const char* b, bool natural){
+    for(;;){
+        size_t la = 0, lb = 0;
+        while(a[la]!=0 && a[la]!='.')la++;
+        while(b[lb]!=0 && b[lb]!='.')lb++;
+
+        int cmp = cmp_segment(a,la,b,lb,natural);
+        if(cmp!=0)return cmp;
+
+        bool enda = a[la]==0, endb = b[lb]==0;
+        if(enda || endb)return (int)endb-(int)enda;
+        a+=la+1;
+        b+=lb+1;
     }
-    //TODO: Implement logic
-    return -1;
 }
 
 }
@@ -2,29 +2,307 @@
 #include <string_view>
 #include <variant>
 #include <vs-templ.hpp>
+#include "scan.hpp"
+#include "thread-pool.hpp"
 #include "utils.hpp"
 
 namespace vs{
 namespace templ{
 
+void render_context::reset(){
+    compiled.reset();
+    symbols.reset();
+    stack_template=decltype(stack_template)();
+    stack_data=decltype(stack_data)();
+    stack_compiled=decltype(stack_compiled)();
+    _logs.clear();
+    used_nodes=0;
+    used_bytes=0;
+    used_iterations=0;
+    ticks=0;
+    _aborted=abort_t::NONE;
+    root_data={};
+    flushed_bytes=0;
+    opened.clear();
+    pending.clear();
+    spliced.clear();
+    prepared_children.clear();
+    prepared_props.clear();
+    started=std::chrono::steady_clock::now();
+}
+
+const char* abort_t::to_string(values v){
+    switch(v){
+        case NONE: return "none";
+        case NODES: return "max-nodes";
+        case BYTES: return "max-bytes";
+        case ITERATIONS: return "max-iterations";
+        case DEPTH: return "max-depth";
+        case DEADLINE: return "deadline";
+        case CANCELLED: return "cancelled";
+    }
+    return "unknown";
+}
+
 void preprocessor::init(const pugi::xml_node& root_data, const pugi::xml_node& root_template,const char* prefix, uint64_t seed){
-    stack_template.emplace(root_template.begin(),root_template.end());
-    stack_compiled.emplace(compiled);
     this->root_data=root_data;
+    this->named_data.clear();
+    this->root_template=root_template;
     this->seed=seed;
-    symbols.set("$",root_data);
     ns(prefix);
 }
 
-void preprocessor::reset(){
-    symbols.reset();
-    stack_template=decltype(stack_template)();
-    stack_data=decltype(stack_data)();
-    stack_compiled=decltype(stack_compiled)();
-    _logs=decltype(_logs)();
+void preprocessor::render(render_context& ctx) const{render(ctx,root_data,nullptr,0);}
+
+void preprocessor::render(render_context& ctx, stream_buffer& out, size_t flush_every) const{render(ctx,root_data,&out,flush_every);}
+
+void preprocessor::render(render_context& ctx, const pugi::xml_node& data) const{render(ctx,data,nullptr,0);}
+
+void preprocessor::render(render_context& ctx, const pugi::xml_node& data, stream_buffer* out, size_t flush_every) const{
+    ctx.reset();
+    ctx._stream=out;
+    ctx.flush_every=flush_every;
+    ctx.root_data=data;
+    ctx.stack_template.emplace(root_template.begin(),root_template.end());
+    ctx.stack_compiled.emplace(ctx.compiled);
+    for(const auto& [name,root] : named_data)ctx.symbols.set(name,root);
+    ctx.symbols.set("$",data);
+    if(ctx._stream!=nullptr)ctx.pending="<?xml version=\"1.0\"?>";
+    _parse(ctx,{});
+    if(ctx._stream!=nullptr){
+        if(ctx._aborted==abort_t::NONE || !_limits.discard_partial)flush(ctx,true);
+    }
+    else if(ctx._aborted!=abort_t::NONE && _limits.discard_partial)ctx.compiled.reset();
+    ctx._stream=nullptr;
+}
+
+void preprocessor::abort(render_context& ctx, abort_t::values reason) const{
+    if(ctx._aborted!=abort_t::NONE)return;
+    ctx._aborted=reason;
+    if(reason==abort_t::CANCELLED){ctx.log(log_t::INFO, log_t::RENDER_CANCELLED, -1);return;}
+    ctx.log(log_t::ERROR, log_t::RENDER_ABORTED, ctx.stack_template.empty()?-1:ctx.stack_template.top().first->offset_debug(), abort_t::to_string(reason));
+}
+
+bool preprocessor::charge(render_context& ctx, size_t nodes, size_t bytes) const{
+    if(ctx._aborted!=abort_t::NONE)return false;
+    ctx.used_nodes+=nodes;
+    ctx.used_bytes+=bytes;
+    if(_limits.max_nodes!=0 && ctx.used_nodes>_limits.max_nodes){abort(ctx,abort_t::NODES);return false;}
+    if(_limits.max_bytes!=0 && ctx.used_bytes>_limits.max_bytes){abort(ctx,abort_t::BYTES);return false;}
+    if(_limits.max_depth!=0 && ctx.stack_template.size()>_limits.max_depth){abort(ctx,abort_t::DEPTH);return false;}
+    //Reading the clock is not free, only do it every few steps.
+    if(_limits.deadline.count()!=0 && ((++ctx.ticks)&63)==0 && std::chrono::steady_clock::now()-ctx.started>_limits.deadline){abort(ctx,abort_t::DEADLINE);return false;}
+    return true;
+}
+
+bool preprocessor::iterate(render_context& ctx) const{
+    if(ctx._aborted!=abort_t::NONE)return false;
+    ctx.used_iterations++;
+    if(_limits.max_iterations!=0 && ctx.used_iterations>_limits.max_iterations){abort(ctx,abort_t::ITERATIONS);return false;}
+    return charge(ctx,0,0);
+}
+
+/*
+    Merge sort on the pool: runs are sorted on their own, then merged in pairs. Runs are taken in order, and merging
+    prefers the left run on ties, so the result is the same as a single std::stable_sort.
+*/
+template<typename T, typename Less>
+static void parallel_stable_sort(thread_pool& pool, std::vector<T>& data, const Less& less){
+    size_t runs = std::min(pool.size()+1,data.size());
+    std::vector<size_t> bounds(runs+1);
+    for(size_t i=0;i<=runs;i++)bounds[i]=data.size()*i/runs;
+
+    pool.parallel_for(runs,[&](size_t i){
+        std::stable_sort(data.begin()+bounds[i],data.begin()+bounds[i+1],less);
+    });
+
+    std::vector<T> buffer(data.size());
+    while(bounds.size()>2){
+        size_t pairs = (bounds.size()-1)/2;
+        pool.parallel_for(pairs,[&](size_t i){
+            auto begin = data.begin();
+            std::merge(begin+bounds[2*i],begin+bounds[2*i+1],begin+bounds[2*i+1],begin+bounds[2*i+2],buffer.begin()+bounds[2*i],less);
+        });
+        //An odd run out is carried over as it is.
+        if((bounds.size()-1)%2==1)std::copy(data.begin()+bounds[bounds.size()-2],data.end(),buffer.begin()+bounds[bounds.size()-2]);
+        std::vector<size_t> merged;
+        for(size_t i=0;i<bounds.size();i+=2)merged.push_back(bounds[i]);
+        if(merged.back()!=data.size())merged.push_back(data.size());
+        bounds=std::move(merged);
+        data.swap(buffer);
+    }
+}
+
+//Size of a subtree, as accounted by the output budgets.
+static void subtree_cost(const pugi::xml_node& node, size_t& nodes, size_t& bytes){
+    nodes++;
+    bytes+=strlen(node.name())+strlen(node.value());
+    for(const auto& attr: node.attributes())bytes+=strlen(attr.name())+strlen(attr.value());
+    for(const auto& child: node.children())subtree_cost(child,nodes,bytes);
+}
+
+std::optional<concrete_symbol> preprocessor::resolve_literal(const char* str){
+    if(str[0]=='.' || str[0]=='+' || str[0]=='-' || (str[0]>='0' && str[0]<='9')){
+        auto n = parse_number(str,true).value_or((int64_t)0);
+        if(std::holds_alternative<int64_t>(n))return std::get<int64_t>(n);
+        else return std::get<double>(n);
+    }
+    else if(str[0]=='#') return std::string(str+1);  //Consider what follows as a string
+    return {};
+}
+
+//Numeric value of a symbol holding a number.
+static std::optional<number_t> symbol_number(const concrete_symbol& sym){
+    if(std::holds_alternative<int64_t>(sym))return std::get<int64_t>(sym);
+    else if(std::holds_alternative<double>(sym))return std::get<double>(sym);
+    return {};
+}
+
+//Integer value of a symbol holding a number, with floating point values truncated.
+static int64_t symbol_int(const std::optional<concrete_symbol>& sym, int64_t defval){
+    auto n = sym.has_value()?symbol_number(sym.value()):std::nullopt;
+    if(!n.has_value())return defval;
+    if(std::holds_alternative<int64_t>(n.value()))return std::get<int64_t>(n.value());
+    double d = std::get<double>(n.value());
+    if(d>=9.2e18)return INT64_MAX;
+    if(d<=-9.2e18)return INT64_MIN;
+    return (int64_t)d;
+}
+
+//Text of a symbol holding a string, an attribute or a node. Null for numbers.
+static const char* symbol_text(const concrete_symbol& sym){
+    if(std::holds_alternative<std::string>(sym))return std::get<std::string>(sym).c_str();
+    else if(std::holds_alternative<const pugi::xml_attribute>(sym))return std::get<const pugi::xml_attribute>(sym).as_string();
+    else if(std::holds_alternative<const pugi::xml_node>(sym))return std::get<const pugi::xml_node>(sym).text().as_string();
+    return nullptr;
+}
+
+//Equality as used by `when`: numeric if at least one side is a number, textual otherwise.
+static bool symbol_equals(const concrete_symbol& a, const concrete_symbol& b){
+    auto na = symbol_number(a), nb = symbol_number(b);
+    if(na.has_value() || nb.has_value()){
+        if(!na.has_value()){const char* t = symbol_text(a); if(t!=nullptr)na=parse_number(t);}
+        if(!nb.has_value()){const char* t = symbol_text(b); if(t!=nullptr)nb=parse_number(t);}
+        return na.has_value() && nb.has_value() && cmp_number(na.value(),nb.value())==0;
+    }
+    const char* op1 = symbol_text(a), *op2 = symbol_text(b);
+    return op1!=nullptr && op2!=nullptr && strcmp(op1,op2)==0;
+}
+
+//Three-way comparison of sort keys. Numbers are compared by value, strings by content, anything else by the natural order of symbols.
+static int cmp_keys(const std::optional<concrete_symbol>& a, const std::optional<concrete_symbol>& b){
+    if(!a.has_value() || !b.has_value())return (int)a.has_value()-(int)b.has_value();
+    auto na = symbol_number(a.value()), nb = symbol_number(b.value());
+    if(na.has_value() && nb.has_value())return cmp_number(na.value(),nb.value());
+    if(a.value()<b.value())return -1;
+    else if(b.value()<a.value())return 1;
+    return 0;
+}
+
+void preprocessor::compile(){
+    plan = {};
+    compile(root_template);
+}
+
+bool preprocessor::compile(const pugi::xml_node& node){
+    bool is_plain = !in_ns(node.name());
+    bool is_static = is_plain;
+    for(const auto& attr: node.attributes()){
+        if(in_ns(attr.name())){is_static=false;break;}
+    }
+    if(is_plain && !is_static)compile_props(node);
+
+    if(strcmp(node.name(),strings.WHEN_TAG)==0){
+        //Only build a table if every case can be decided without evaluating anything.
+        when_table_t table;
+        bool literal = true;
+        for(const auto& entry: node.children(strings.IS_TAG)){
+            auto test = resolve_literal(entry.attribute("value").as_string("$"));
+            if(!test.has_value()){literal=false;break;}
+            uint32_t idx = table.cases.size();
+            table.cases.push_back(entry);
+            table.continues.push_back(entry.attribute("continue").as_bool(false));
+            if(auto n = symbol_number(test.value()); n.has_value())table.by_number[normalize_number(n.value())].push_back(idx);
+            else{
+                const auto& str = std::get<std::string>(test.value());
+                table.by_string[str].push_back(idx);
+                if(auto n = parse_number(str); n.has_value())table.by_numeric_string[normalize_number(n.value())].push_back(idx);
+            }
+        }
+        if(literal)plan.when.emplace(node.internal_object(),std::move(table));
+    }
+
+    std::vector<pugi::xml_node> static_children;
+    for(const auto& child: node.children()){
+        if(compile(child))static_children.push_back(child);
+        else is_static=false;
+    }
+
+    //Only keep the largest static subtrees, those inside are never visited while rendering.
+    if(!is_static || node==root_template){
+        for(const auto& child: static_children){
+            static_t cost;
+            subtree_cost(child,cost.nodes,cost.bytes);
+            plan.static_subtrees.emplace(child.internal_object(),cost);
+        }
+    }
+    return is_static;
 }
 
-std::optional<concrete_symbol> preprocessor::resolve_expr(const std::string_view& _str, const pugi::xml_node* base) const{
+void preprocessor::compile_props(const pugi::xml_node& node){
+    props_t props;
+
+    for(const auto& attr: node.attributes()){
+        const char* name = attr.name();
+        if(!in_ns(name)){
+            props.attrs.push_back({props_t::attr_t::STATIC,attr,name});
+            continue;
+        }
+        //What follows `prop.` in the name, the attribute to compute or the group of a cycle.
+        auto target = [&](const char* prop)->const char*{
+            size_t len = strlen(prop);
+            return (strncmp(name,prop,len)==0 && name[len]=='.' && name[len+1]!=0)?name+len+1:nullptr;
+        };
+        //Props of the same cycle share their group, the cycle takes the place of the first one.
+        auto cycle = [&](tag_t::values type, const char* group)->props_t::cycle_t&{
+            for(auto& c: props.cycles)if(c.type==type && strcmp(c.group,group)==0)return c;
+            props.attrs.push_back({props_t::attr_t::CYCLE,attr,group,props.cycles.size()});
+            return props.cycles.emplace_back(props_t::cycle_t{type,group});
+        };
+        const char* group;
+
+        if((group=target(strings.FOR_IN_PROP))!=nullptr || (group=target(strings.FOR_SRC_PROP))!=nullptr)cycle(tag_t::FOR,group).in=attr.value();
+        else if((group=target(strings.FOR_SORT_BY_PROP))!=nullptr)cycle(tag_t::FOR,group).sort_by=attr.value();
+        else if((group=target(strings.FOR_ORDER_BY_PROP))!=nullptr)cycle(tag_t::FOR,group).order_by=attr.value();
+        else if((group=target(strings.FOR_LIMIT_PROP))!=nullptr)cycle(tag_t::FOR,group).limit=attr.value();
+        else if((group=target(strings.FOR_OFFSET_PROP))!=nullptr)cycle(tag_t::FOR,group).offset=attr.value();
+        else if((group=target(strings.FOR_PROPS_IN_PROP))!=nullptr || (group=target(strings.FOR_PROPS_SRC_PROP))!=nullptr)cycle(tag_t::FOR_PROPS,group).in=attr.value();
+        else if((group=target(strings.FOR_PROPS_ORDER_BY_PROP))!=nullptr)cycle(tag_t::FOR_PROPS,group).order_by=attr.value();
+        else if((group=target(strings.FOR_PROPS_LIMIT_PROP))!=nullptr)cycle(tag_t::FOR_PROPS,group).limit=attr.value();
+        else if((group=target(strings.FOR_PROPS_OFFSET_PROP))!=nullptr)cycle(tag_t::FOR_PROPS,group).offset=attr.value();
+        //TODO: filter has not defined syntax yet.
+        else if(target(strings.FOR_FILTER_PROP)!=nullptr || target(strings.FOR_PROPS_FILTER_PROP)!=nullptr){}
+        else if((group=target(strings.VALUE_SRC_PROP))!=nullptr)props.attrs.push_back({props_t::attr_t::VALUE,attr,group});
+        //TODO: `use.*` and `eval.*` wait for the stack based language.
+        else if(target(strings.USE_SRC_PROP)!=nullptr || strncmp(name+ns_prefix.length(),"eval.",5)==0){}
+        else props.attrs.push_back({props_t::attr_t::UNKNOWN,attr,name});
+    }
+    plan.props.emplace(node.internal_object(),std::move(props));
+}
+
+std::vector<std::pair<std::string,preprocessor::order_method_t::values>> preprocessor::make_criteria(const char* sort_by, const char* order_by){
+    std::vector<std::pair<std::string,order_method_t::values>> criteria;
+    auto orders = split_string(order_by,',');
+    int c = 0;
+    //Apply order directive with wrapping in case not enough cases are specified.
+    for(auto& i:split_string(sort_by,',')){
+        criteria.emplace_back(i,order_method_t::from_string(orders[c%orders.size()]));
+        c++;
+    }
+    return criteria;
+}
+
+std::optional<concrete_symbol> preprocessor::resolve_expr(const render_context& ctx, const std::string_view& _str, const pugi::xml_node* base) const{
     int str_len = _str.size(); 
     char str[str_len+1];
     memcpy(str,_str.data(),str_len+1);
@@ -32,19 +310,20 @@ std::optional<concrete_symbol> preprocessor::resolve_expr(const std::string_view
 
     pugi::xml_node ref;
     int idx = 0;
-    if(str[0]=='.' || str[0]=='+' || str[0]=='-' || (str[0]>'0' && str[0]<'9')) return atoi(str);
-    else if(str[0]=='#') return std::string(str+1);  //Consider what follows as a string
+    if(auto literal = resolve_literal(str); literal.has_value()) return literal;
     else if(str[0]=='{'){
-        int close = 0;
-        for(;close<str_len && str[close]!='}';close++);
+        int close = scan_kernels().find_any(str,str_len,'}','}');
         str[close]=0;
-        auto tmp = symbols.resolve(std::string_view(str+1,str+close));
+        auto tmp = ctx.symbols.resolve(std::string_view(str+1,str+close));
         if(!tmp.has_value())return {};
         else if(std::holds_alternative<const pugi::xml_node>(tmp.value())){
             ref=std::get<const pugi::xml_node>(tmp.value());
         }
-        else if(std::holds_alternative<int>(tmp.value())){
-            return std::get<int>(tmp.value());
+        else if(std::holds_alternative<int64_t>(tmp.value())){
+            return std::get<int64_t>(tmp.value());
+        }
+        else if(std::holds_alternative<double>(tmp.value())){
+            return std::get<double>(tmp.value());
         }
         else if(std::holds_alternative<const pugi::xml_attribute>(tmp.value())){
             return std::get<const pugi::xml_attribute>(tmp.value());
@@ -55,7 +334,7 @@ std::optional<concrete_symbol> preprocessor::resolve_expr(const std::string_view
     else if(str[0]=='$'){
 
         if(base==nullptr){
-            auto tmp = symbols.resolve("$");
+            auto tmp = ctx.symbols.resolve("$");
             if(!tmp.has_value() || std::holds_alternative<const pugi::xml_node>(tmp.value())==false)return {};
             else{
                 ref=std::get<const pugi::xml_node>(tmp.value());
@@ -67,14 +346,13 @@ std::optional<concrete_symbol> preprocessor::resolve_expr(const std::string_view
         idx++;
     }
     else if(str[0]=='/'){
-        ref=root_data;
+        ref=ctx.root_data;
         idx++;
     }
 
     //Recurse over **/ blocks
     for(;;){
-        int close = idx;
-        for(;close<str_len && str[close]!='/' && str[close]!='~';close++);
+        int close = idx+scan_kernels().find_any(str+idx,str_len-idx,'/','~');
         char oldc=str[close];
         str[close]=0;
         if(idx!=close)ref = ref.child(str+idx);         //Avoid the prefix /
@@ -95,11 +373,16 @@ std::optional<concrete_symbol> preprocessor::resolve_expr(const std::string_view
 }
 
 preprocessor::order_method_t::values preprocessor::order_method_t::from_string(std::string_view str){
-    bool dot_eval=false;
-    if(str[0]=='.')dot_eval=true;
-    if((std::string_view(str.begin()+dot_eval, str.end()) == std::string_view("asc")))return (values)((dot_eval?USE_DOT_EVAL:UNKNOWN)|ASC);
-    else if((std::string_view(str.begin()+dot_eval, str.end()) == std::string_view("desc")))return (values)((dot_eval?USE_DOT_EVAL:UNKNOWN)|DESC);
-    else if((std::string_view(str.begin()+dot_eval, str.end()) == std::string_view("random")))return (values)((dot_eval?USE_DOT_EVAL:UNKNOWN)|RANDOM);
+    int flags=UNKNOWN;
+    if(str.size()>0 && str[0]=='.'){flags|=USE_DOT_EVAL;str.remove_prefix(1);}
+    if(auto sep = str.find(':'); sep!=std::string_view::npos){
+        if(str.substr(sep+1)=="num")flags|=USE_NUMERIC;
+        else return order_method_t::UNKNOWN;
+        str=str.substr(0,sep);
+    }
+    if(str=="asc")return (values)(flags|ASC);
+    else if(str=="desc")return (values)(flags|DESC);
+    else if(str=="random")return (values)(flags|RANDOM);
     else return order_method_t::UNKNOWN;
 }
 
@@ -119,8 +402,8 @@ void preprocessor::ns_strings::prepare(const char * ns_prefix){
         STRLEN("eval")+
         STRLEN("element")+STRLEN("type")+
 
-        STRLEN("for.in")+STRLEN("for.filter")+STRLEN("for.sort-by")+STRLEN("for.order-by")+STRLEN("for.offset")+STRLEN("for.limit")+
-        STRLEN("for-props.in")+STRLEN("for-props.filter")+STRLEN("for.order-by")+STRLEN("for-props.offset")+STRLEN("for-props.limit")+
+        STRLEN("for.in")+STRLEN("for.src")+STRLEN("for.filter")+STRLEN("for.sort-by")+STRLEN("for.order-by")+STRLEN("for.offset")+STRLEN("for.limit")+
+        STRLEN("for-props.in")+STRLEN("for-props.src")+STRLEN("for-props.filter")+STRLEN("for-props.order-by")+STRLEN("for-props.offset")+STRLEN("for-props.limit")+
         
         STRLEN("value.src")+STRLEN("value.format")+
         STRLEN("eval.src")+STRLEN("eval.format")+
@@ -155,12 +438,12 @@ void preprocessor::ns_strings::prepare(const char * ns_prefix){
     WRITE(FOR_LIMIT_PROP,"for.limit");
 
 
-    WRITE(FOR_PROPS_IN_PROP,"for.in");
-    WRITE(FOR_PROPS_SRC_PROP,"for.src");
-    WRITE(FOR_PROPS_FILTER_PROP,"for.filter");
-    WRITE(FOR_PROPS_ORDER_BY_PROP,"for.order-by");
-    WRITE(FOR_PROPS_OFFSET_PROP,"for.offset");
-    WRITE(FOR_PROPS_LIMIT_PROP,"for.limit");
+    WRITE(FOR_PROPS_IN_PROP,"for-props.in");
+    WRITE(FOR_PROPS_SRC_PROP,"for-props.src");
+    WRITE(FOR_PROPS_FILTER_PROP,"for-props.filter");
+    WRITE(FOR_PROPS_ORDER_BY_PROP,"for-props.order-by");
+    WRITE(FOR_PROPS_OFFSET_PROP,"for-props.offset");
+    WRITE(FOR_PROPS_LIMIT_PROP,"for-props.limit");
         
     WRITE(VALUE_SRC_PROP,"value.src");
     WRITE(VALUE_FORMAT_PROP,"value.format");
@@ -175,16 +458,43 @@ void preprocessor::ns_strings::prepare(const char * ns_prefix){
 
 
 
-std::vector<pugi::xml_attribute> preprocessor::prepare_props_data(const pugi::xml_node& base, int limit, int offset, bool(*filter)(const pugi::xml_attribute&), order_method_t::values criterion){
+template<typename T>
+preprocessor::window_t<T>::window_t(std::shared_ptr<const std::vector<T>>&& data, int limit, int offset){
+    int size = data->size();
+    if(offset<0)offset=0;
+    else if(offset>=size)return;
+    //Positive limits take that many entries at most, negative ones leave out that many from the end.
+    int end = size;
+    if(limit>0)end=std::min(size,offset+limit);
+    else if(limit<0)end=size+limit;
+    if(end<=offset)return;
+    this->data=std::move(data);
+    from=offset;
+    to=end;
+}
+
+//Identity of a collection within a render: its data node, its filter and how it is sorted.
+static void prepared_key(std::string& key, const pugi::xml_node& base, const void* filter){
+    auto node = base.internal_object();
+    key.append((const char*)&node,sizeof(node));
+    key.append((const char*)&filter,sizeof(filter));
+}
+
+preprocessor::window_t<pugi::xml_attribute> preprocessor::prepare_props_data(render_context& ctx, const pugi::xml_node& base, int limit, int offset, bool(*filter)(const pugi::xml_attribute&), order_method_t::values criterion) const{
+    std::string key;
+    prepared_key(key,base,(const void*)filter);
+    key.append((const char*)&criterion,sizeof(criterion));
+    if(auto it = ctx.prepared_props.find(key); it!=ctx.prepared_props.end())return {std::shared_ptr(it->second),limit,offset};
+
     auto cmp_fn = [&](const pugi::xml_attribute& a, const pugi::xml_attribute& b)->int{
         if(criterion==order_method_t::ASC){
             int cmp =  strcmp(a.name(),b.name());
-            if(cmp==-1)return true;
+            if(cmp<0)return true;
             else return false;
         }
         else if(criterion==order_method_t::DESC){
             int cmp =  strcmp(a.name(),b.name());
-            if(cmp==1)return true;
+            if(cmp>0)return true;
             else return false;
         }
         else{
@@ -200,116 +510,206 @@ std::vector<pugi::xml_attribute> preprocessor::prepare_props_data(const pugi::xm
         if(filter==nullptr || filter(child))dataset.push_back(child);
     }
 
-    std::sort(dataset.begin(),dataset.end(),cmp_fn);
+    std::stable_sort(dataset.begin(),dataset.end(),cmp_fn);
 
-    //TODO: Check if these boudary condition are sound.
-    if(offset<0)offset=0;
-    else if(offset>=(int)dataset.size())return {};
-    if(limit>0 && offset+limit>(int)dataset.size())limit=dataset.size()-offset;
-    else if(limit<0 && (int)dataset.size()+limit<=offset)return {};
-
-    else if(limit<=0)return std::vector(dataset.begin()+offset, dataset.end()-limit);
-    else return std::vector(dataset.begin()+offset, dataset.begin()+offset+limit);
-
-    return {};
+    auto prepared = std::make_shared<const std::vector<pugi::xml_attribute>>(std::move(dataset));
+    ctx.prepared_props.emplace(std::move(key),prepared);
+    return {std::move(prepared),limit,offset};
 }
 
-std::vector<pugi::xml_node> preprocessor::prepare_children_data(const pugi::xml_node& base, int limit, int offset, bool(*filter)(const pugi::xml_node&), const std::vector<std::pair<std::string,order_method_t::values>>& criteria){
-    auto cmp_fn = [&](const pugi::xml_node& a, const pugi::xml_node& b)->int{
-        for(auto& criterion: criteria){
-            auto valA = resolve_expr(criterion.first.c_str(),&a);
-            auto valB = resolve_expr(criterion.first.c_str(),&b);
+preprocessor::window_t<pugi::xml_node> preprocessor::prepare_children_data(render_context& ctx, const pugi::xml_node& base, int limit, int offset, bool(*filter)(const pugi::xml_node&), const std::vector<std::pair<std::string,order_method_t::values>>& criteria) const{
+    //Keys reading symbols can change from one cycle to the next, and their collections cannot be reused.
+    bool reusable = true;
+    std::string key;
+    prepared_key(key,base,(const void*)filter);
+    for(auto& criterion: criteria){
+        if(criterion.first.starts_with('{'))reusable=false;
+        key.append((const char*)&criterion.second,sizeof(criterion.second));
+        key.append(criterion.first);
+        key.push_back(0);
+    }
+    if(reusable){
+        if(auto it = ctx.prepared_children.find(key); it!=ctx.prepared_children.end())return {std::shared_ptr(it->second),limit,offset};
+    }
 
-            if(criterion.second==order_method_t::ASC){
-                if(valA<valB)return true;
-                else if(valA>valB) return false;
-            }
-            else if(criterion.second==order_method_t::DESC){
-                if(valA<valB)return false;
-                else if(valA>valB) return true;
-            }
-            else if(criterion.second==(order_method_t::ASC | order_method_t::USE_DOT_EVAL)){
-                if(valA.has_value() && std::holds_alternative<std::string>(valA.value()) && valB.has_value() && std::holds_alternative<std::string>(valB.value())){
-                    const std::string& strA = std::get<std::string>(valA.value());
-                    const std::string& strB = std::get<std::string>(valB.value());
-
-                    auto i = cmp_dot_str(strA.c_str(), strB.c_str());
-                    if(i<0)return true;
-                    else if(i>0)return false;
+    std::vector<pugi::xml_node> dataset;
+    for(auto& child: base.children()){
+        if(filter==nullptr || filter(child))dataset.push_back(child);
+    }
+
+    if(criteria.size()>0 && dataset.size()>1){
+        //Extract and cast all keys once, so that comparisons never evaluate expressions.
+        const size_t width = criteria.size();
+        std::vector<std::optional<concrete_symbol>> keys(dataset.size()*width);
+
+        //Each row only writes its own slots, so blocks of rows can be extracted in parallel.
+        auto extract = [&](size_t from, size_t to){
+            for(size_t i=from;i<to;i++){
+                for(size_t c=0;c<width;c++){
+                    auto key = resolve_expr(ctx,criteria[c].first,&dataset[i]);
+                    if(!key.has_value())continue;
+                    auto& slot = keys[i*width+c];
+                    if(criteria[c].second&order_method_t::USE_DOT_EVAL){
+                        //Numeric here means natural ordering of segments, no cast is needed.
+                        slot.emplace(std::move(key.value()));
+                        continue;
+                    }
+                    if((criteria[c].second&order_method_t::USE_NUMERIC) && !symbol_number(key.value()).has_value()){
+                        const char* text = symbol_text(key.value());
+                        auto n = text!=nullptr?parse_number(text):std::nullopt;
+                        if(n.has_value()){
+                            if(std::holds_alternative<int64_t>(n.value()))key.emplace(std::get<int64_t>(n.value()));
+                            else key.emplace(std::get<double>(n.value()));
+                        }
+                    }
+                    slot.emplace(std::move(key.value()));
                 }
-                else return false;
             }
-            else if(criterion.second==(order_method_t::DESC | order_method_t::USE_DOT_EVAL)){
-                if(valA.has_value() && std::holds_alternative<std::string>(valA.value()) && valB.has_value() && std::holds_alternative<std::string>(valB.value())){
-                    const std::string& strA = std::get<std::string>(valA.value());
-                    const std::string& strB = std::get<std::string>(valB.value());
-
-                    auto i = cmp_dot_str(strA.c_str(), strB.c_str());
-                    if(i>0)return true;
-                    else if(i<0)return false;
+        };
+
+        std::vector<uint32_t> order(dataset.size());
+        for(uint32_t i=0;i<order.size();i++)order[i]=i;
+
+        auto less = [&](uint32_t a, uint32_t b){
+            for(size_t c=0;c<width;c++){
+                auto method = criteria[c].second;
+                int cmp;
+                if(method&order_method_t::USE_DOT_EVAL){
+                    //Only strings can be compared this way, anything else is considered equivalent.
+                    const auto& ka = keys[a*width+c], &kb = keys[b*width+c];
+                    bool strings = ka.has_value() && kb.has_value() && std::holds_alternative<std::string>(ka.value()) && std::holds_alternative<std::string>(kb.value());
+                    cmp = strings?cmp_dot_str(std::get<std::string>(ka.value()).c_str(),std::get<std::string>(kb.value()).c_str(),method&order_method_t::USE_NUMERIC):0;
+                }
+                else cmp = cmp_keys(keys[a*width+c],keys[b*width+c]);
+                if(cmp==0)continue;
+                switch(method&~(order_method_t::USE_DOT_EVAL|order_method_t::USE_NUMERIC)){
+                    case order_method_t::ASC: return cmp<0;
+                    case order_method_t::DESC: return cmp>0;
+                    //TODO: Random is based on the hash of the value. It requires to be stable: as such, a fast hashing function is needed (externally supplied, C++ has none).
+                    default: break;
                 }
-                else return false;
             }
-            else{
-                //TODO: methods not implemented. The dot variants are only valid for strings or string-like content. They uses `.` to nest the search in blocks, like for prop names.
-                //Random is based on the hash of the value. It requires to be stable: as such, a fast hashing function is needed (externally supplied, C++ has none).
+            return false;
+        };
 
-            }
+        //Stable, so that equivalent entries keep their document order.
+        if(_parallel_threshold==0 || dataset.size()<_parallel_threshold){
+            extract(0,dataset.size());
+            std::stable_sort(order.begin(),order.end(),less);
+        }
+        else{
+            auto& pool = thread_pool::shared();
+            constexpr size_t BLOCK = 1024;
+            pool.parallel_for((dataset.size()+BLOCK-1)/BLOCK,[&](size_t block){
+                extract(block*BLOCK,std::min(dataset.size(),(block+1)*BLOCK));
+            });
+            parallel_stable_sort(pool,order,less);
         }
-        return false;
-    };
-    
-    std::vector<pugi::xml_node> dataset;
-    for(auto& child: base.children()){
-        if(filter==nullptr || filter(child))dataset.push_back(child);
-    }
-
-    std::sort(dataset.begin(),dataset.end(),cmp_fn);
 
-    //TODO: Check if these boudary condition are sound.
-    if(offset<0)offset=0;
-    else if(offset>=(int)dataset.size())return {};
-    if(limit>0 && offset+limit>(int)dataset.size())limit=dataset.size()-offset;
-    else if(limit<0 && (int)dataset.size()+limit<=offset)return {};
+        std::vector<pugi::xml_node> sorted(dataset.size());
+        for(size_t i=0;i<order.size();i++)sorted[i]=dataset[order[i]];
+        dataset=std::move(sorted);
+    }
 
-    else if(limit<=0)return std::vector(dataset.begin()+offset, dataset.end()-limit);
-    else return std::vector(dataset.begin()+offset, dataset.begin()+offset+limit);
+    auto prepared = std::make_shared<const std::vector<pugi::xml_node>>(std::move(dataset));
+    if(reusable)ctx.prepared_children.emplace(std::move(key),prepared);
+    return {std::move(prepared),limit,offset};
+}
 
-    return {};
+pugi::xml_node preprocessor::append_element(render_context& ctx, pugi::xml_node& parent, const pugi::xml_node& node, const props_t* props) const{
+    auto last = parent.append_child(node.type());
+    last.set_name(node.name());
+    last.set_value(node.value());
+    size_t bytes = strlen(last.name())+strlen(last.value());
+    if(props==nullptr){
+        //None of them is a namespace prop, as found when compiling.
+        for(const auto& attr: node.attributes()){
+            last.append_attribute(attr.name()).set_value(attr.value());
+            bytes+=strlen(attr.name())+strlen(attr.value());
+        }
+    }
+    else for(const auto& entry: props->attrs){
+        if(entry.kind==props_t::attr_t::STATIC){
+            last.append_attribute(entry.name).set_value(entry.attr.value());
+            bytes+=strlen(entry.name)+strlen(entry.attr.value());
+        }
+        else if(entry.kind==props_t::attr_t::VALUE){
+            //Expressions with no value leave the attribute out.
+            auto value = resolve_expr(ctx,entry.attr.value());
+            if(!value.has_value())continue;
+            auto out = last.append_attribute(entry.name);
+            if(auto n = symbol_number(value.value()); n.has_value())out.set_value(number_to_string(n.value()).c_str());
+            else out.set_value(symbol_text(value.value()));
+            bytes+=strlen(entry.name)+strlen(out.value());
+        }
+        else if(entry.kind==props_t::attr_t::CYCLE){
+            //Nothing is added if the collection cannot be found.
+            const auto& cycle = props->cycles[entry.cycle];
+            auto expr = cycle.in!=nullptr?resolve_expr(ctx,cycle.in):std::nullopt;
+            if(!expr.has_value() || !std::holds_alternative<const pugi::xml_node>(expr.value()))continue;
+            const auto& base = std::get<const pugi::xml_node>(expr.value());
+            int limit = symbol_int(resolve_expr(ctx,cycle.limit),0);
+            int offset = symbol_int(resolve_expr(ctx,cycle.offset),0);
+
+            auto add = [&](const char* name, const char* value){
+                if(!iterate(ctx))return false;
+                last.append_attribute(name).set_value(value);
+                bytes+=strlen(name)+strlen(value);
+                return true;
+            };
+            if(cycle.type==tag_t::FOR){
+                //Each child element becomes an attribute, with its text as value.
+                for(auto& i : prepare_children_data(ctx, base, limit, offset, nullptr, make_criteria(cycle.sort_by,cycle.order_by))){
+                    if(i.type()==pugi::node_element && !add(i.name(),i.text().get()))break;
+                }
+            }
+            else{
+                for(auto& i : prepare_props_data(ctx, base, limit, offset, nullptr, order_method_t::from_string(cycle.order_by)))if(!add(i.name(),i.value()))break;
+            }
+        }
+        else ctx.log(log_t::ERROR, log_t::UNKNOWN_PROP_OPERATION, node.offset_debug(), entry.attr.name());
+    }
+    //The node crossing a budget is not left in the partial output.
+    if(!charge(ctx,1,bytes)){parent.remove_child(last);return {};}
+    return last;
 }
 
-void preprocessor::_parse(std::optional<pugi::xml_node_iterator> stop_at){ 
+void preprocessor::_parse(render_context& ctx, std::optional<pugi::xml_node_iterator> stop_at) const{ 
     
-    while(!stack_template.empty()){
+    while(!ctx.stack_template.empty()){
 
-        auto& current_template = stack_template.top();
-        auto& current_compiled = stack_compiled.top();
+        auto& current_template = ctx.stack_template.top();
+        auto& current_compiled = ctx.stack_compiled.top();
 
         if(stop_at.has_value() && current_template.first==stop_at)break;
+        if(ctx._aborted!=abort_t::NONE)break;
+        if(ctx._stream!=nullptr && ctx.used_bytes-ctx.flushed_bytes>=ctx.flush_every)flush(ctx,false);
 
         if(current_template.first!=current_template.second){
 
             //Special handling of static element
-            if(strncmp(current_template.first->name(),ns_prefix.c_str(),ns_prefix.length())==0) {
-                if(strcmp(current_template.first->name(),strings.FOR_RANGE_TAG)==0){
+            auto op = classify(current_template.first->name());
+            if(op!=tag_t::NONE) {
+                if(op==tag_t::FOR_RANGE){
                     const char* tag = current_template.first->attribute("tag").as_string();
-                    int from = get_or<int>(resolve_expr(current_template.first->attribute("from").as_string("0")).value_or(0),0);
-                    int to = get_or<int>(resolve_expr(current_template.first->attribute("to").as_string("0")).value_or(0),0);
-                    int step = get_or<int>(resolve_expr(current_template.first->attribute("step").as_string("1")).value_or(1),1);
+                    int64_t from = symbol_int(resolve_expr(ctx,current_template.first->attribute("from").as_string("0")),0);
+                    int64_t to = symbol_int(resolve_expr(ctx,current_template.first->attribute("to").as_string("0")),0);
+                    int64_t step = symbol_int(resolve_expr(ctx,current_template.first->attribute("step").as_string("1")),1);
                     if(step>0 && to<from){/* Skip infinite loop*/}
                     else if(step<0 && to>from){/* Skip infinite loop*/}
                     else if(step==0){/* Skip potentially infinite loop*/}
-                    else for(int i=from; i<to; i+=step){
-                        auto frame_guard = symbols.guard();
-                        if(tag!=nullptr)symbols.set(tag,i);
-                        symbols.set("$",i);
-                        stack_template.emplace(current_template.first->begin(),current_template.first->end());
-                        _parse(current_template.first);
+                    else for(int64_t i=from; i<to; i+=step){
+                        if(!iterate(ctx))break;
+                        auto frame_guard = ctx.symbols.guard();
+                        if(tag!=nullptr)ctx.symbols.set(tag,i);
+                        ctx.symbols.set("$",i);
+                        ctx.stack_template.emplace(current_template.first->begin(),current_template.first->end());
+                        _parse(ctx,current_template.first);
                         //When exiting one too many is removed. restore it.
-                        stack_compiled.emplace(current_compiled);
+                        ctx.stack_compiled.emplace(current_compiled);
                     }
                 }
-                else if(strcmp(current_template.first->name(),strings.FOR_TAG)==0){
+                else if(op==tag_t::FOR){
                     const char* tag = current_template.first->attribute("tag").as_string();
                     const char* in = current_template.first->attribute("in").as_string(current_template.first->attribute("src").as_string());
                     //TODO: filter has not defined syntax yet.
@@ -318,60 +718,50 @@ void preprocessor::_parse(std::optional<pugi::xml_node_iterator> stop_at){
                     const char* _sort_by = current_template.first->attribute("sort-by").as_string();
                     const char* _order_by = current_template.first->attribute("order-by").as_string("asc");
 
-                    int limit = get_or<int>(resolve_expr(current_template.first->attribute("limit").as_string("0")).value_or(0),0);
-                    int offset = get_or<int>(resolve_expr(current_template.first->attribute("offset").as_string("0")).value_or(0),0);
+                    int limit = symbol_int(resolve_expr(ctx,current_template.first->attribute("limit").as_string("0")),0);
+                    int offset = symbol_int(resolve_expr(ctx,current_template.first->attribute("offset").as_string("0")),0);
                     
-                    auto expr = resolve_expr(in);
+                    auto expr = resolve_expr(ctx,in);
 
 
                     //Only a node is acceptable in this context, otherwise show the error
                     if(!expr.has_value() || !std::holds_alternative<const pugi::xml_node>(expr.value())){ 
                         for(const auto& el: current_template.first->children(strings.ERROR_TAG)){
-                            stack_template.emplace(el.begin(),el.end());
-                            _parse(current_template.first);
-                            stack_compiled.emplace(current_compiled);
+                            ctx.stack_template.emplace(el.begin(),el.end());
+                            _parse(ctx,current_template.first);
+                            ctx.stack_compiled.emplace(current_compiled);
                         }
                     }
                     else{
-                        std::vector<std::pair<std::string,order_method_t::values>> criteria;
-                        //Build criteria
-                        {
-                            auto orders = split_string(_order_by,',');
-                            int c = 0;
-                            //Apply order directive with wrapping in case not enough cases are specified.
-                            for(auto& i:split_string(_sort_by,',')){
-                                criteria.emplace_back(i,order_method_t::from_string(orders[c%orders.size()]));
-                                c++;
-                            }
-                        }
-                        auto good_data = prepare_children_data(std::get<const pugi::xml_node>(expr.value()), limit, offset, nullptr, criteria);
+                        auto good_data = prepare_children_data(ctx, std::get<const pugi::xml_node>(expr.value()), limit, offset, nullptr, make_criteria(_sort_by,_order_by));
 
                         if(good_data.size()==0){
                             for(const auto& el: current_template.first->children(strings.EMPTY_TAG)){
-                                stack_template.emplace(el.begin(),el.end());
-                                _parse(current_template.first);
-                                stack_compiled.emplace(current_compiled);
+                                ctx.stack_template.emplace(el.begin(),el.end());
+                                _parse(ctx,current_template.first);
+                                ctx.stack_compiled.emplace(current_compiled);
                             }
                         }
                         else{
                             //Header (once)
                             {
                                 for(const auto& el: current_template.first->children(strings.HEADER_TAG)){
-                                    stack_template.emplace(el.begin(),el.end());
-                                    _parse(current_template.first);
-                                    stack_compiled.emplace(current_compiled);
+                                    ctx.stack_template.emplace(el.begin(),el.end());
+                                    _parse(ctx,current_template.first);
+                                    ctx.stack_compiled.emplace(current_compiled);
                                 }
                             }
                         
                             //Items (iterate)
                             for(auto& i : good_data){
-                                auto frame_guard = symbols.guard();
-                                if(tag!=nullptr)symbols.set(tag,i);
-                                symbols.set("$",i);
+                                if(!iterate(ctx))break;
+                                auto frame_guard = ctx.symbols.guard();
+                                if(tag!=nullptr)ctx.symbols.set(tag,i);
+                                ctx.symbols.set("$",i);
                                 for(const auto& el: current_template.first->children(strings.ITEM_TAG)){
-                                    stack_template.emplace(el.begin(),el.end());
-                                    _parse(current_template.first);
-                                    stack_compiled.emplace(current_compiled);
+                                    ctx.stack_template.emplace(el.begin(),el.end());
+                                    _parse(ctx,current_template.first);
+                                    ctx.stack_compiled.emplace(current_compiled);
                                 }
 
                             }
@@ -379,15 +769,15 @@ void preprocessor::_parse(std::optional<pugi::xml_node_iterator> stop_at){
                             //Footer (once)
                             {
                                 for(const auto& el: current_template.first->children(strings.FOOTER_TAG)){
-                                    stack_template.emplace(el.begin(),el.end());
-                                    _parse(current_template.first);
-                                    stack_compiled.emplace(current_compiled);
+                                    ctx.stack_template.emplace(el.begin(),el.end());
+                                    _parse(ctx,current_template.first);
+                                    ctx.stack_compiled.emplace(current_compiled);
                                 }
                             }
                         }
                     }
                 }
-                else if(strcmp(current_template.first->name(),strings.FOR_PROPS_TAG)==0){
+                else if(op==tag_t::FOR_PROPS){
                     const char* tag = current_template.first->attribute("tag").as_string();
                     const char* in = current_template.first->attribute("in").as_string();
                     //TODO: filter has not defined syntax yet.
@@ -395,49 +785,50 @@ void preprocessor::_parse(std::optional<pugi::xml_node_iterator> stop_at){
 
                     const char* _order_by = current_template.first->attribute("order-by").as_string("asc");
 
-                    int limit = get_or<int>(resolve_expr(current_template.first->attribute("limit").as_string("0")).value_or(0),0);
-                    int offset = get_or<int>(resolve_expr(current_template.first->attribute("offset").as_string("0")).value_or(0),0);
+                    int limit = symbol_int(resolve_expr(ctx,current_template.first->attribute("limit").as_string("0")),0);
+                    int offset = symbol_int(resolve_expr(ctx,current_template.first->attribute("offset").as_string("0")),0);
                     
-                    auto expr = resolve_expr(in);
+                    auto expr = resolve_expr(ctx,in);
 
 
                     //Only a node is acceptable in this context, otherwise show the error
                     if(!expr.has_value() || !std::holds_alternative<const pugi::xml_node>(expr.value())){ 
                         for(const auto& el: current_template.first->children(strings.ERROR_TAG)){
-                            stack_template.emplace(el.begin(),el.end());
-                            _parse(current_template.first);
-                            stack_compiled.emplace(current_compiled);
+                            ctx.stack_template.emplace(el.begin(),el.end());
+                            _parse(ctx,current_template.first);
+                            ctx.stack_compiled.emplace(current_compiled);
                         }
                     }
                     else{
-                        auto good_data = prepare_props_data(std::get<const pugi::xml_node>(expr.value()), limit, offset, nullptr,order_method_t::from_string(_order_by));
+                        auto good_data = prepare_props_data(ctx, std::get<const pugi::xml_node>(expr.value()), limit, offset, nullptr,order_method_t::from_string(_order_by));
 
                         if(good_data.size()==0){
                             for(const auto& el: current_template.first->children(strings.EMPTY_TAG)){
-                                stack_template.emplace(el.begin(),el.end());
-                                _parse(current_template.first);
-                                stack_compiled.emplace(current_compiled);
+                                ctx.stack_template.emplace(el.begin(),el.end());
+                                _parse(ctx,current_template.first);
+                                ctx.stack_compiled.emplace(current_compiled);
                             }
                         }
                         else{
                             //Header (once)
                             {
                                 for(const auto& el: current_template.first->children(strings.HEADER_TAG)){
-                                    stack_template.emplace(el.begin(),el.end());
-                                    _parse(current_template.first);
-                                    stack_compiled.emplace(current_compiled);
+                                    ctx.stack_template.emplace(el.begin(),el.end());
+                                    _parse(ctx,current_template.first);
+                                    ctx.stack_compiled.emplace(current_compiled);
                                 }
                             }
                         
                             //Items (iterate)
                             for(auto& i : good_data){
-                                auto frame_guard = symbols.guard();
-                                if(tag!=nullptr)symbols.set(tag,i);
-                                symbols.set("$",i);
+                                if(!iterate(ctx))break;
+                                auto frame_guard = ctx.symbols.guard();
+                                if(tag!=nullptr)ctx.symbols.set(tag,i);
+                                ctx.symbols.set("$",i);
                                 for(const auto& el: current_template.first->children(strings.ITEM_TAG)){
-                                    stack_template.emplace(el.begin(),el.end());
-                                    _parse(current_template.first);
-                                    stack_compiled.emplace(current_compiled);
+                                    ctx.stack_template.emplace(el.begin(),el.end());
+                                    _parse(ctx,current_template.first);
+                                    ctx.stack_compiled.emplace(current_compiled);
                                 }
 
                             }
@@ -445,107 +836,144 @@ void preprocessor::_parse(std::optional<pugi::xml_node_iterator> stop_at){
                             //Footer (once)
                             {
                                 for(const auto& el: current_template.first->children(strings.FOOTER_TAG)){
-                                    stack_template.emplace(el.begin(),el.end());
-                                    _parse(current_template.first);
-                                    stack_compiled.emplace(current_compiled);
+                                    ctx.stack_template.emplace(el.begin(),el.end());
+                                    _parse(ctx,current_template.first);
+                                    ctx.stack_compiled.emplace(current_compiled);
                                 }
                             }
                         }
                     }
                 }
-                else if(strcmp(current_template.first->name(), strings.ELEMENT_TAG)==0){
+                else if(op==tag_t::ELEMENT){
                     //It is possible for it to generate strange results as strings are not validated by pugi
-                    auto symbol = resolve_expr(current_template.first->attribute(strings.TYPE_ATTR).as_string("$"));
+                    auto symbol = resolve_expr(ctx,current_template.first->attribute(strings.TYPE_ATTR).as_string("$"));
                     if(!symbol.has_value()){
                     }
                     else if(std::holds_alternative<std::string>(symbol.value())){
                         auto child = current_compiled.append_child(std::get<std::string>(symbol.value()).c_str());
+                        size_t bytes = strlen(child.name());
                         for(auto& attr : current_template.first->attributes()){
-                            if(strcmp(attr.name(),strings.TYPE_ATTR)!=0)child.append_attribute(attr.name()).set_value(attr.value());
+                            if(strcmp(attr.name(),strings.TYPE_ATTR)!=0){
+                                child.append_attribute(attr.name()).set_value(attr.value());
+                                bytes+=strlen(attr.name())+strlen(attr.value());
+                            }
                         }
-                        stack_compiled.emplace(child);
+                        if(!charge(ctx,1,bytes)){current_compiled.remove_child(child);current_template.first++;continue;}
+                        ctx.stack_compiled.emplace(child);
 
-                        stack_template.emplace(current_template.first->begin(),current_template.first->end());
-                        _parse(current_template.first);
-                        stack_compiled.emplace(current_compiled);
+                        ctx.stack_template.emplace(current_template.first->begin(),current_template.first->end());
+                        _parse(ctx,current_template.first);
+                        ctx.stack_compiled.emplace(current_compiled);
                     }
                     else if(std::holds_alternative<const pugi::xml_node>(symbol.value())){
                         auto child = current_compiled.append_child(std::get<const pugi::xml_node>(symbol.value()).text().as_string());
+                        size_t bytes = strlen(child.name());
                         for(auto& attr : current_template.first->attributes()){
-                            if(strcmp(attr.name(),strings.TYPE_ATTR)!=0)child.append_attribute(attr.name()).set_value(attr.value());
+                            if(strcmp(attr.name(),strings.TYPE_ATTR)!=0){
+                                child.append_attribute(attr.name()).set_value(attr.value());
+                                bytes+=strlen(attr.name())+strlen(attr.value());
+                            }
                         }
-                        stack_compiled.emplace(child);
+                        if(!charge(ctx,1,bytes)){current_compiled.remove_child(child);current_template.first++;continue;}
+                        ctx.stack_compiled.emplace(child);
 
-                        stack_template.emplace(current_template.first->begin(),current_template.first->end());
-                        _parse(current_template.first);
-                        stack_compiled.emplace(current_compiled);
+                        ctx.stack_template.emplace(current_template.first->begin(),current_template.first->end());
+                        _parse(ctx,current_template.first);
+                        ctx.stack_compiled.emplace(current_compiled);
                     }
                     else{}
                 }
-                else if(strcmp(current_template.first->name(), strings.VALUE_TAG)==0){
-                    auto symbol = resolve_expr(current_template.first->attribute("src").as_string("$"));
+                else if(op==tag_t::VALUE){
+                    auto symbol = resolve_expr(ctx,current_template.first->attribute("src").as_string("$"));
                     if(!symbol.has_value()){
                         /*Show default content if search fails*/
-                        stack_template.emplace(current_template.first->begin(),current_template.first->end());
-                        _parse(current_template.first);
-                        stack_compiled.emplace(current_compiled);
+                        ctx.stack_template.emplace(current_template.first->begin(),current_template.first->end());
+                        _parse(ctx,current_template.first);
+                        ctx.stack_compiled.emplace(current_compiled);
                     }
                     else{
-                        if(std::holds_alternative<int>(symbol.value())){
-                            current_compiled.append_child(pugi::node_pcdata).set_value(std::to_string(std::get<int>(symbol.value())).c_str());
+                        if(auto n = symbol_number(symbol.value()); n.has_value()){
+                            auto text = number_to_string(n.value());
+                            if(charge(ctx,1,text.size()))current_compiled.append_child(pugi::node_pcdata).set_value(text.c_str());
                         }
                         else if(std::holds_alternative<const pugi::xml_attribute>(symbol.value())) {
-                            current_compiled.append_child(pugi::node_pcdata).set_value(std::get<const pugi::xml_attribute>(symbol.value()).as_string());
+                            const char* text = std::get<const pugi::xml_attribute>(symbol.value()).as_string();
+                            if(charge(ctx,1,strlen(text)))current_compiled.append_child(pugi::node_pcdata).set_value(text);
                         }
                         else if(std::holds_alternative<std::string>(symbol.value())) {
-                            current_compiled.append_child(pugi::node_pcdata).set_value(std::get<std::string>(symbol.value()).c_str());
+                            const auto& text = std::get<std::string>(symbol.value());
+                            if(charge(ctx,1,text.size()))current_compiled.append_child(pugi::node_pcdata).set_value(text.c_str());
                         }
                         else if(std::holds_alternative<const pugi::xml_node>(symbol.value())) {
                             auto tmp = std::get<const pugi::xml_node>(symbol.value());
-                            current_compiled.append_copy(tmp);
+                            //Only output budgets and streaming look at the size, skip the walk otherwise.
+                            size_t nodes=1, bytes=0;
+                            if(_limits.max_nodes!=0 || _limits.max_bytes!=0 || ctx._stream!=nullptr){nodes=0;subtree_cost(tmp,nodes,bytes);}
+                            if(!charge(ctx,nodes,bytes)){}
+                            //Streamed renders write the data subtree in place, instead of copying it in the output first.
+                            else if(ctx._stream!=nullptr && tmp.type()!=pugi::node_document && tmp.type()!=pugi::node_null){
+                                auto placeholder = current_compiled.append_child(pugi::node_pi);
+                                ctx.spliced.emplace(placeholder.internal_object(),tmp);
+                            }
+                            else current_compiled.append_copy(tmp);
                         }
                     }
                 }
-                else if(strcmp(current_template.first->name(),strings.WHEN_TAG)==0){
-                    auto subject = resolve_expr(current_template.first->attribute("subject").as_string("$"));
-                    for(const auto& entry: current_template.first->children(strings.IS_TAG)){
+                else if(op==tag_t::WHEN){
+                    auto subject = resolve_expr(ctx,current_template.first->attribute("subject").as_string("$"));
+                    auto table = plan.when.find(current_template.first->internal_object());
+                    if(table!=plan.when.end()){
+                        //All cases are literals: find the matching ones with a lookup per interpretation of the subject.
+                        static const std::vector<uint32_t> none;
+                        const std::vector<uint32_t>* first = &none, *second = &none;
+                        auto find = [](const auto& map, const auto& key, const std::vector<uint32_t>*& ret){
+                            auto it = map.find(key);
+                            if(it!=map.end())ret=&it->second;
+                        };
+                        if(!subject.has_value()){}
+                        else if(auto n = symbol_number(subject.value()); n.has_value()){
+                            find(table->second.by_number,normalize_number(n.value()),first);
+                            find(table->second.by_numeric_string,normalize_number(n.value()),second);
+                        }
+                        else if(const char* op = symbol_text(subject.value()); op!=nullptr){
+                            find(table->second.by_string,std::string_view(op),first);
+                            if(auto n = parse_number(op); n.has_value())find(table->second.by_number,normalize_number(n.value()),second);
+                        }
+                        //Both lists are sorted and disjoint, merge them to keep the document order.
+                        for(size_t i=0, j=0; i<first->size() || j<second->size();){
+                            uint32_t idx;
+                            if(j>=second->size() || (i<first->size() && (*first)[i]<(*second)[j]))idx=(*first)[i++];
+                            else idx=(*second)[j++];
+
+                            const auto& entry = table->second.cases[idx];
+                            ctx.stack_template.emplace(entry.begin(),entry.end());
+                            _parse(ctx,current_template.first);
+                            ctx.stack_compiled.emplace(current_compiled);
+
+                            if(table->second.continues[idx]==false)break;
+                        }
+                    }
+                    else for(const auto& entry: current_template.first->children(strings.IS_TAG)){
                         bool _continue =  entry.attribute("continue").as_bool(false);
-                        auto test = resolve_expr(entry.attribute("value").as_string("$"));
+                        auto test = resolve_expr(ctx,entry.attribute("value").as_string("$"));
 
                         bool result = false;
-                        //TODO: Perform comparison.
 
                         if(!subject.has_value() && !test.has_value()){result = true;}
                         else if (!subject.has_value() || !test.has_value()){result = false;}
-                        else if(std::holds_alternative<int>(subject.value()) && std::holds_alternative<int>(test.value())){
-                            result = std::get<int>(subject.value())==std::get<int>(test.value());
-                        }
-                        else{
-
-                            //Move everything to string
-                            const char* op1=nullptr,* op2=nullptr;
-                            if(std::holds_alternative<std::string>(subject.value()))op1=std::get<std::string>(subject.value()).c_str();
-                            else if(std::holds_alternative<const pugi::xml_attribute>(subject.value()))op1=std::get<const pugi::xml_attribute>(subject.value()).as_string();
-                            else if(std::holds_alternative<const pugi::xml_node>(subject.value()))op1=std::get<const pugi::xml_node>(subject.value()).text().as_string();
-
-                            if(std::holds_alternative<std::string>(test.value()))op2=std::get<std::string>(test.value()).c_str();
-                            else if(std::holds_alternative<const pugi::xml_attribute>(test.value()))op2=std::get<const pugi::xml_attribute>(test.value()).as_string();
-                            else if(std::holds_alternative<const pugi::xml_node>(test.value()))op2=std::get<const pugi::xml_node>(test.value()).text().as_string();
-
-                            result = op1!=nullptr && op2!=nullptr && strcmp(op1,op2)==0;
-                        }
+                        else result = symbol_equals(subject.value(),test.value());
                 
                         if(result){
-                            stack_template.emplace(entry.begin(),entry.end());
-                            _parse(current_template.first);
-                            stack_compiled.emplace(current_compiled);
+                            ctx.stack_template.emplace(entry.begin(),entry.end());
+                            _parse(ctx,current_template.first);
+                            ctx.stack_compiled.emplace(current_compiled);
 
                             if(_continue==false)break;
                         }
                     }
                 }
                 else {
-                    log(log_t::ERROR, "unrecognized static operation `%s`\n",current_template.first->name());
+                    ctx.log(log_t::ERROR, log_t::UNKNOWN_OPERATION, current_template.first->offset_debug(), current_template.first->name());
                 }
                 
                 current_template.first++;
@@ -554,30 +982,28 @@ void preprocessor::_parse(std::optional<pugi::xml_node_iterator> stop_at){
         
             
 
-            auto last = current_compiled.append_child(current_template.first->type());
-            last.set_name(current_template.first->name());
-            last.set_value(current_template.first->value());
-            for(const auto& attr :current_template.first->attributes()){
-                //Special handling of static attribute rewrite rules
-                if(strncmp(attr.name(), ns_prefix.c_str(), ns_prefix.length())==0){
-                    if(cexpr_strneqv(attr.name()+ns_prefix.length(),"for.src.")){}
-                    else if(cexpr_strneqv(attr.name()+ns_prefix.length(),"for-props.src.")){}
-                    else if(cexpr_strneqv(attr.name()+ns_prefix.length(),"use.src.")){}
-                    else if(cexpr_strneqv(attr.name()+ns_prefix.length(),"eval.")){}
-                    else {log(log_t::ERROR, "unrecognized static operation `%s`\n",current_template.first->name());}
-                }
-                else last.append_attribute(attr.name()).set_value(attr.value());
+            //Subtrees without namespace content are copied as they are, in one go.
+            if(auto it = plan.static_subtrees.find(current_template.first->internal_object()); it!=plan.static_subtrees.end()){
+                if(charge(ctx,it->second.nodes,it->second.bytes))current_compiled.append_copy(*current_template.first);
+                current_template.first++;
+                continue;
             }
+
+            auto it = plan.props.find(current_template.first->internal_object());
+            const props_t* props = it!=plan.props.end()?&it->second:nullptr;
+
+            auto last = append_element(ctx,current_compiled,*current_template.first,props);
+            if(!last)continue;
             if(!current_template.first->children().empty()){
         
-                stack_template.emplace(current_template.first->children().begin(),current_template.first->children().end());
-                stack_compiled.emplace(last);
+                ctx.stack_template.emplace(current_template.first->children().begin(),current_template.first->children().end());
+                ctx.stack_compiled.emplace(last);
             }
             current_template.first++;
         }
         else{
-            stack_template.pop();
-            stack_compiled.pop();
+            ctx.stack_template.pop();
+            ctx.stack_compiled.pop();
         }
     }
 
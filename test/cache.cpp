@@ -0,0 +1,171 @@
+/**
+ * @file cache.cpp
+ * @author karurochari
+ * @brief Test for the cache of whole renders of vs.templ
+ * Covers keys, misses, hits with their logs replayed, eviction of the least
+ * recently used entries and of files left behind by interrupted writes, files
+ * which are not entries being left alone, and threads storing the same entry
+ * at once.
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <cache.hpp>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace vs::templ;
+namespace fs = std::filesystem;
+
+static int failures = 0;
+
+static void check(bool condition, const char *what) {
+  if (!condition) {
+    std::cerr << "Failed: " << what << "\n";
+    failures++;
+  }
+}
+
+// Fetch an entry through a file, as the CLI does with stdout.
+static bool fetch(const render_cache &cache, const fs::path &dir,
+                  const std::string &key, std::string &output,
+                  std::string &logs) {
+  auto path = dir / "fetched";
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0)
+    return false;
+  bool ret = cache.fetch(key, fd, &logs);
+  close(fd);
+  std::ifstream file(path, std::ios::binary);
+  output.assign(std::istreambuf_iterator<char>(file),
+                std::istreambuf_iterator<char>());
+  fs::remove(path);
+  return ret;
+}
+
+static void age(const fs::path &path, std::chrono::minutes by) {
+  fs::last_write_time(path, fs::file_time_type::clock::now() - by);
+}
+
+int main() {
+  fs::path dir = fs::temp_directory_path() /
+                 ("vs-templ-cache-" + std::to_string(getpid()));
+  fs::path entries = dir / "entries";
+  std::string output, logs;
+
+  check(render_cache::key({"ab", "c"}) != render_cache::key({"a", "bc"}),
+        "bytes moved across parts change the key");
+  check(render_cache::key({"a", "b"}) == render_cache::key({"a", "b"}),
+        "keys are stable");
+
+  {
+    render_cache cache(entries, 1024);
+    auto key = render_cache::key({"template", "data"});
+    check(!fetch(cache, dir, key, output, logs), "a new cache misses");
+
+    cache.store(key, "<root />", "[error] something\n");
+    check(fetch(cache, dir, key, output, logs), "a stored entry hits");
+    check(output == "<root />", "the output is copied back");
+    check(logs == "[error] something\n", "the logs are replayed");
+  }
+
+  {
+    // Each entry takes 100 bytes, only three fit.
+    fs::path lru = dir / "lru";
+    render_cache cache(lru, 300);
+    std::vector<std::string> keys;
+    for (int i = 0; i < 4; i++) {
+      keys.push_back(render_cache::key({std::to_string(i)}));
+      cache.store(keys[i], std::string(90, 'x'), std::string(10, 'y'));
+      age(lru / (keys[i] + ".xml"), std::chrono::minutes(10 - i));
+    }
+    check(!fs::exists(lru / (keys[0] + ".xml")) &&
+              !fs::exists(lru / (keys[0] + ".log")),
+          "the oldest entry is evicted with its logs");
+    check(fs::exists(lru / (keys[1] + ".xml")) &&
+              fs::exists(lru / (keys[3] + ".xml")),
+          "entries within the size are kept");
+
+    // Using the oldest entry makes the next one the least recently used.
+    check(fetch(cache, dir, keys[1], output, logs), "an old entry still hits");
+    cache.store(render_cache::key({"new"}), std::string(90, 'x'),
+                std::string(10, 'y'));
+    check(fs::exists(lru / (keys[1] + ".xml")),
+          "a recently used entry is kept");
+    check(!fs::exists(lru / (keys[2] + ".xml")),
+          "the least recently used entry is evicted");
+  }
+
+  {
+    render_cache cache(entries, 1 << 20);
+    auto dead = render_cache::key({"dead"});
+    auto orphan = entries / (dead + ".log");
+    auto tmp = entries / (dead + ".xml.tmp.abcdef");
+    auto fresh = entries / (render_cache::key({"live"}) + ".xml.tmp.abcdef");
+    auto other = entries / "notes.txt";
+    auto foreign = entries / "mine.log";
+    for (auto &path : {orphan, tmp, fresh, other, foreign})
+      std::ofstream(path) << "left over";
+    for (auto &path : {orphan, tmp, other, foreign})
+      age(path, std::chrono::minutes(10));
+    cache.evict();
+    check(!fs::exists(orphan) && !fs::exists(tmp),
+          "stale files of interrupted writes are removed");
+    check(fs::exists(fresh), "files being written are left alone");
+    check(fs::exists(other) && fs::exists(foreign),
+          "unrelated files are left alone");
+  }
+
+  {
+    // Files which are not entries neither count nor get evicted.
+    fs::path mixed = dir / "mixed";
+    fs::create_directories(mixed);
+    std::ofstream(mixed / "mine.xml") << std::string(200, 'x');
+    std::ofstream(mixed / ("abc" + std::string(61, 'g') + ".xml"))
+        << std::string(200, 'x');
+    age(mixed / "mine.xml", std::chrono::minutes(10));
+    render_cache cache(mixed, 150);
+    auto key = render_cache::key({"mixed"});
+    cache.store(key, std::string(90, 'x'), std::string(10, 'y'));
+    check(fs::exists(mixed / "mine.xml") &&
+              fs::exists(mixed / ("abc" + std::string(61, 'g') + ".xml")),
+          "foreign xml files survive eviction");
+    check(fs::exists(mixed / (key + ".xml")),
+          "foreign files do not count towards the size");
+  }
+
+  {
+    // Threads storing the same key must leave one whole entry behind.
+    render_cache cache(entries, 1 << 20);
+    auto key = render_cache::key({"shared"});
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 8; t++)
+      writers.emplace_back([&, t]() {
+        for (int r = 0; r < 16; r++)
+          cache.store(key, std::string(4096, 'a' + t), "");
+      });
+    for (auto &writer : writers)
+      writer.join();
+    check(fetch(cache, dir, key, output, logs), "the shared entry hits");
+    check(output.size() == 4096 &&
+              output == std::string(4096, output.empty() ? 0 : output[0]),
+          "concurrent stores do not mix their content");
+    for (auto &file : fs::directory_iterator(entries))
+      check(file.path().filename().string().find(".tmp.") ==
+                    std::string::npos ||
+                file.path().filename() ==
+                    render_cache::key({"live"}) + ".xml.tmp.abcdef",
+            "no temporary file is left behind");
+  }
+
+  fs::remove_all(dir);
+  return failures == 0 ? 0 : 1;
+}
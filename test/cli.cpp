@@ -0,0 +1,157 @@
+/**
+ * @file cli.cpp
+ * @author karurochari
+ * @brief Test for the command line interface of vs.templ
+ * The template and data of a test file are written to files of their own and
+ * rendered by the CLI given as first argument, with the budgets of the test
+ * file passed as options and named data roots as `name=file` arguments.
+ * The main data is given once as a file, which the CLI maps and parses in
+ * place, and once through a pipe. Both outputs must match the expected one,
+ * and the exit code must be 4 for renders exceeding a budget. Named roots
+ * called `$` or given twice must be rejected.
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <pugixml.hpp>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common.hpp"
+
+namespace fs = std::filesystem;
+
+// The children of `node` as a document of their own.
+static bool write_children(const fs::path &path, const pugi::xml_node &node) {
+  std::ofstream file(path);
+  bool any = false;
+  for (auto &child : node.children()) {
+    child.print(file, "", pugi::format_raw);
+    any |= child.type() == pugi::node_element;
+  }
+  // A document needs a root element to be parsed at all.
+  if (!any)
+    file << "<data />";
+  return bool(file);
+}
+
+static int run(const std::string &command) {
+  int status = std::system(command.c_str());
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Run the CLI, returning its exit code and parsed output.
+static int render(const std::string &command, const fs::path &out,
+                  pugi::xml_document &output, bool &parsed) {
+  int code = run(command + " > '" + out.string() + "' 2> /dev/null");
+  parsed = output.load_file(out.c_str()).status == pugi::status_ok;
+  return code;
+}
+
+int main(int argc, const char **argv) {
+  assert(argc > 2);
+  test_case test;
+  if (int ret = test.load(argv[2]); ret != 0)
+    return ret;
+
+  // Not exposed by the CLI.
+  if (test.seed != 0 || test.limits.discard_partial)
+    return 77;
+
+  fs::path dir = fs::temp_directory_path() /
+                 ("vs-templ-cli-" + fs::path(argv[2]).stem().string() + "-" +
+                  std::to_string(getpid()));
+  fs::create_directories(dir);
+  if (!write_children(dir / "template.xml", test.tmpl) ||
+      !write_children(dir / "data.xml", test.data)) {
+    std::cerr << "Cannot write the inputs in " << dir << "\n";
+    return 1;
+  }
+
+  std::string command = std::string("'") + argv[1] + "'";
+  auto option = [&](const char *name, size_t value) {
+    if (value != 0)
+      command += std::string(" --") + name + "=" + std::to_string(value);
+  };
+  option("max-nodes", test.limits.max_nodes);
+  option("max-bytes", test.limits.max_bytes);
+  option("max-iterations", test.limits.max_iterations);
+  option("max-depth", test.limits.max_depth);
+  option("timeout", test.limits.deadline.count());
+  command += " '" + (dir / "template.xml").string() + "'";
+
+  std::string named;
+  for (auto &root : test.doc.child("test").children("data")) {
+    if (!root.attribute("name"))
+      continue;
+    std::string name = root.attribute("name").as_string();
+    if (!write_children(dir / (name + ".xml"), root)) {
+      std::cerr << "Cannot write the inputs in " << dir << "\n";
+      return 1;
+    }
+    named += " '" + name + "=" + (dir / (name + ".xml")).string() + "'";
+  }
+
+  // Regular files are mapped and parsed in place, pipes are read.
+  pugi::xml_document mapped, piped;
+  bool mapped_parsed, piped_parsed;
+  int mapped_code =
+      render(command + " '" + (dir / "data.xml").string() + "'" + named,
+             dir / "mapped.xml", mapped, mapped_parsed);
+  int piped_code = render("cat '" + (dir / "data.xml").string() + "' | " +
+                              command + " /dev/stdin" + named,
+                          dir / "piped.xml", piped, piped_parsed);
+
+  int reserved_code = 1, repeated_code = 1;
+  if (!named.empty()) {
+    std::string main_data = " '" + (dir / "data.xml").string() + "'";
+    reserved_code = run(command + main_data + " '$=" +
+                        (dir / "data.xml").string() + "'" +
+                        " > /dev/null 2>&1");
+    repeated_code =
+        run(command + main_data + named + named + " > /dev/null 2>&1");
+  }
+  fs::remove_all(dir);
+
+  if (reserved_code != 1 || repeated_code != 1) {
+    std::cerr << "Named roots called `$` or given twice must exit with 1, got "
+              << reserved_code << " and " << repeated_code << "\n";
+    return 4;
+  }
+
+  std::stringstream serial_expects;
+  test.expects.print(serial_expects);
+  int expected = strcmp(test.aborts, "none") == 0 ? 0 : 4;
+
+  for (auto [input, code, parsed, output] :
+       {std::tuple{"mapped", mapped_code, mapped_parsed, &mapped},
+        std::tuple{"piped", piped_code, piped_parsed, &piped}}) {
+    if (code != expected) {
+      std::cerr << "Exit code " << code << " with " << input
+                << " data, expected " << expected << "\n";
+      return 2;
+    }
+    if (!parsed) {
+      std::cerr << "The output with " << input << " data is not valid XML\n";
+      return 3;
+    }
+    std::stringstream serial;
+    output->print(serial);
+    if (serial.str() != serial_expects.str()) {
+      std::cerr << "Output with " << input << " data differs\n--- Output ---\n"
+                << serial.str() << "\n--- Expected ---\n"
+                << serial_expects.str() << "\n";
+      return 3;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+/**
+ * @file common.hpp
+ * @author karurochari
+ * @brief Loading of the test files shared by all the tester programs.
+ * A test file has a `test` root with the `template`, the main `data`, any
+ * number of named `data` roots and the `expects`ed output.
+ * Budgets for the render are set as attributes of the root, named after the
+ * options of the CLI, and `aborts` names the budget expected to be exceeded.
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <pugixml.hpp>
+#include <vs-templ.hpp>
+
+struct test_case {
+  pugi::xml_document doc;
+  pugi::xml_node data;
+  pugi::xml_node tmpl;
+  pugi::xml_node expects;
+  uint64_t seed = 0;
+  vs::templ::limits_t limits;
+  const char *aborts = "none";
+
+  /**
+   * @brief Load the test file at `path`.
+   *
+   * @return 0 on success, 77 for placeholders of cases yet to be written, so
+   * that they are reported as skipped, 1 if the file could not be parsed.
+   */
+  int load(const char *path) {
+    pugi::xml_parse_result ret = doc.load_file(path);
+    if (ret.status == pugi::status_no_document_element)
+      return 77;
+    if (ret.status != 0) {
+      std::cerr << "Load result: " << ret.description() << ret.status
+                << std::endl;
+      return 1;
+    }
+
+    auto test = doc.child("test");
+    data = test.child("data");
+    tmpl = test.child("template");
+    expects = test.child("expects").first_child();
+    seed = test.attribute("seed").as_int(0);
+
+    limits.max_nodes = test.attribute("max-nodes").as_ullong(0);
+    limits.max_bytes = test.attribute("max-bytes").as_ullong(0);
+    limits.max_iterations = test.attribute("max-iterations").as_ullong(0);
+    limits.max_depth = test.attribute("max-depth").as_ullong(0);
+    limits.deadline =
+        std::chrono::milliseconds(test.attribute("timeout").as_ullong(0));
+    limits.discard_partial = test.attribute("discard-partial").as_bool(false);
+    aborts = test.attribute("aborts").as_string("none");
+    return 0;
+  }
+
+  // The render stopped for the expected reason, if any.
+  bool aborted_as_expected(vs::templ::abort_t::values reason) const {
+    if (strcmp(vs::templ::abort_t::to_string(reason), aborts) == 0)
+      return true;
+    std::cerr << "Render aborted by `" << vs::templ::abort_t::to_string(reason)
+              << "`, expected `" << aborts << "`\n";
+    return false;
+  }
+
+  bool has_named_data() const {
+    for (auto &root : doc.child("test").children("data"))
+      if (root.attribute("name"))
+        return true;
+    return false;
+  }
+
+  // Named data roots and budgets.
+  void setup(vs::templ::preprocessor &pdoc) const {
+    pdoc.limits(limits);
+    for (auto &root : doc.child("test").children("data"))
+      if (root.attribute("name"))
+        pdoc.add_data(root.attribute("name").as_string(), root);
+  }
+};
@@ -0,0 +1,66 @@
+/**
+ * @file dot.cpp
+ * @author karurochari
+ * @brief Test for the dot comparator of vs.templ
+ * Covers equal strings, dot-prefixes, and the order of numeric and text
+ * segments with and without natural ordering.
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <utils.hpp>
+
+using namespace vs::templ;
+
+static int failures = 0;
+
+static void check(bool condition, const std::string &what) {
+  if (!condition) {
+    std::cerr << "Failed: " << what << "\n";
+    failures++;
+  }
+}
+
+// `a` must come strictly before `b`, and the comparison must be antisymmetric.
+static void before(const char *a, const char *b, bool natural) {
+  std::string what = std::string(a) + " < " + b + (natural ? " (natural)" : "");
+  check(cmp_dot_str(a, b, natural) < 0 && cmp_dot_str(b, a, natural) > 0,
+        what);
+}
+
+int main() {
+  for (bool natural : {false, true}) {
+    for (const char *str : {"", "a", "a.b", "a..b", "1.10", "x.07"})
+      check(cmp_dot_str(str, str, natural) == 0,
+            std::string("equal strings compare as 0: ") + str);
+
+    before("", "a", natural);
+    before("a", "a.b", natural);
+    before("a.b", "a.b.c", natural);
+    before("a.b.c", "a.c", natural);
+    before("a.c", "b", natural);
+    before("a..b", "a.b", natural);
+    before("ab", "ab.c", natural);
+    before("a.b", "ab", natural);
+  }
+
+  // Without natural ordering digits are text like anything else.
+  before("1.10", "1.9", false);
+  before("a.10", "a.9", false);
+  before("a.1", "a.b", false);
+  check(cmp_dot_str("a.01", "a.1", false) != 0,
+        "leading zeros matter as text");
+
+  // Natural ordering compares numbers by value, and puts them first.
+  before("1.9", "1.10", true);
+  before("a.9", "a.10", true);
+  before("a.10", "a.b", true);
+  before("a.2", "a.2x", true);
+  before("v.1.2", "v.1.10.1", true);
+  check(cmp_dot_str("a.01", "a.1", true) == 0,
+        "leading zeros do not change a value");
+
+  return failures == 0 ? 0 : 1;
+}
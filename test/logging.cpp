@@ -0,0 +1,88 @@
+/**
+ * @file logging.cpp
+ * @author karurochari
+ * @brief Test for the log of renders of vs.templ
+ * Covers the ring buffer overwriting its oldest entries, the counters per
+ * level, filtered and dropped entries, and messages being built only when
+ * requested.
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <iostream>
+#include <logging.hpp>
+#include <string>
+#include <vector>
+
+using namespace vs::templ;
+
+static int failures = 0;
+
+static void check(bool condition, const char *what) {
+  if (!condition) {
+    std::cerr << "Failed: " << what << "\n";
+    failures++;
+  }
+}
+
+static std::vector<int64_t> stored(const logger_t &logs) {
+  std::vector<int64_t> ret;
+  for (auto &log : logs)
+    ret.push_back(std::get<int64_t>(log.arg(0)));
+  return ret;
+}
+
+int main() {
+  // Values of the levels are part of the interface.
+  check(log_t::ERROR == 0 && log_t::WARNING == 1 && log_t::PANIC == 2,
+        "levels keep their values");
+  check(log_t::severity(log_t::INFO) < log_t::severity(log_t::WARNING) &&
+            log_t::severity(log_t::WARNING) < log_t::severity(log_t::ERROR) &&
+            log_t::severity(log_t::ERROR) < log_t::severity(log_t::PANIC),
+        "levels are ranked by severity");
+
+  {
+    logger_t logs(3);
+    for (int64_t i = 0; i < 5; i++)
+      logs.push(log_t(log_t::ERROR, log_t::RENDER_ABORTED, -1, i));
+    check(logs.size() == 3, "the ring keeps its capacity");
+    check(stored(logs) == std::vector<int64_t>({2, 3, 4}),
+          "the oldest entries are overwritten, the rest is in order");
+    check(logs.count(log_t::ERROR) == 5, "overwritten entries are counted");
+    check(logs.dropped() == 2, "overwritten entries are dropped");
+
+    logs.clear();
+    check(logs.empty() && logs.count(log_t::ERROR) == 0 &&
+              logs.dropped() == 0,
+          "clear resets entries and counters");
+  }
+
+  {
+    logger_t logs(4, log_t::WARNING);
+    logs.push(log_t(log_t::INFO, log_t::RENDER_CANCELLED, -1, (int64_t)0));
+    logs.push(log_t(log_t::WARNING, log_t::RENDER_CANCELLED, -1, (int64_t)1));
+    logs.push(log_t(log_t::PANIC, log_t::RENDER_CANCELLED, -1, (int64_t)2));
+    logs.push(log_t(log_t::INFO, log_t::RENDER_CANCELLED, -1, (int64_t)3));
+    logs.push(log_t(log_t::ERROR, log_t::RENDER_CANCELLED, -1, (int64_t)4));
+    check(stored(logs) == std::vector<int64_t>({1, 2, 4}),
+          "entries below the minimum level are not stored");
+    check(logs.count(log_t::INFO) == 2 && logs.count(log_t::WARNING) == 1 &&
+              logs.count(log_t::ERROR) == 1 && logs.count(log_t::PANIC) == 1,
+          "every level has its own counter");
+    check(logs.dropped() == 0, "filtered entries are not dropped");
+  }
+
+  {
+    // String arguments are borrowed, the message is built from them later.
+    char name[] = "s:first";
+    log_t log(log_t::ERROR, log_t::UNKNOWN_OPERATION, 42, (const char *)name);
+    name[2] = 'F';
+    check(log.description() == "unrecognized static operation `s:First` @ 42",
+          "messages are built on request");
+    check(log_t(log_t::ERROR, log_t::RENDER_ABORTED, -1, "max-nodes")
+                  .description() == "render aborted, budget exceeded: max-nodes",
+          "entries without a node have no offset");
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -4,64 +4,204 @@
  * @brief Tester program for vs.templ
  * Use a single file containing data, template and expected to test if the
  * library is doing a good job.
+ * The same preprocessor renders the file several times: every output must be
+ * byte-identical, and the heap allocations and bytes of a render must not
+ * exceed the baseline given as second argument. A missing baseline is a
+ * failure, one recorded with another standard library skips the test. Set
+ * VS_TEMPL_RECORD_BASELINES to write it instead.
+ * Renders expected to exceed a budget must stop for that reason and log it.
  * @copyright Copyright (c) 2024
  *
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <new>
 #include <pugixml.hpp>
 #include <sstream>
+#include <string>
 #include <vs-templ.hpp>
 
+#include "common.hpp"
+
 using namespace vs::templ;
 
+constexpr int RUNS = 8;
+
+// Heap usage of vs.templ itself. pugixml keeps allocating with malloc, so
+// baselines do not depend on its build.
+static std::atomic<size_t> allocations = 0, allocated_bytes = 0;
+
+static void *counted_alloc(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+void *operator new(size_t size) {
+  if (void *ptr = counted_alloc(size))
+    return ptr;
+  throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+// Used for the temporary buffers of std::stable_sort.
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return counted_alloc(size);
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return counted_alloc(size);
+}
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+  std::free(ptr);
+}
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+  std::free(ptr);
+}
+
+struct usage_t {
+  size_t allocations = 0;
+  size_t bytes = 0;
+};
+
+// Allocations depend on the standard library, baselines are only compared
+// with the one they were recorded with.
+static std::string standard_library() {
+#if defined(_LIBCPP_VERSION)
+  std::string name = "libc++-" + std::to_string(_LIBCPP_VERSION);
+#elif defined(_GLIBCXX_RELEASE)
+  std::string name = "libstdc++-" + std::to_string(_GLIBCXX_RELEASE);
+#else
+  std::string name = "unknown";
+#endif
+  return name + "-" + std::to_string(sizeof(void *) * 8) + "bit";
+}
+
 int main(int argc, const char **argv) {
   assert(argc > 1);
-  pugi::xml_document doc;
-  pugi::xml_parse_result ret = doc.load_file(argv[1]);
 
-  if (ret.status != 0) {
-    std::cerr << "Load result: " << ret.description() << ret.status
-              << std::endl;
-    return 1;
-  }
+  test_case test;
+  if (int ret = test.load(argv[1]); ret != 0)
+    return ret;
+  auto expects = test.expects;
 
-  auto data = doc.child("test").child("data");
-  auto tmpl = doc.child("test").child("template");
-  auto expects = doc.child("test").child("expects").first_child();
-  uint64_t seed = doc.child("test").attribute("seed").as_int(0);
-
-  // tmpl.print(std::cout);
-  // data.print(std::cout);
+  // test.tmpl.print(std::cout);
+  // test.data.print(std::cout);
   // expects.print(std::cout);
 
-  preprocessor pdoc(data, tmpl, "s:", seed);
-  auto &result = pdoc.parse();
+  preprocessor pdoc(test.data, test.tmpl, "s:", test.seed);
+  test.setup(pdoc);
 
-  for (auto &log : pdoc.logs()) {
-    if (log.type() == log_t::values::ERROR) {
-      std::cerr << log.description() << "\n";
-    }
-  }
-  // if (!pdoc.result){return 3;}
+  std::string first;
+  usage_t worst;
+  for (int run = 0; run < RUNS; run++) {
+    pdoc.reset();
+    size_t count = allocations, bytes = allocated_bytes;
+    auto &result = pdoc.parse();
+    usage_t usage{allocations - count, allocated_bytes - bytes};
+
+    std::stringstream serial_result;
+    result.print(serial_result);
+
+    if (run == 0) {
+      for (auto &log : pdoc.logs()) {
+        if (log.type() == log_t::values::ERROR) {
+          std::cerr << log.description() << "\n";
+        }
+      }
+      // if (!pdoc.result){return 3;}
+
+      if (!test.aborted_as_expected(pdoc.aborted()))
+        return 6;
+      if (pdoc.aborted() != abort_t::NONE) {
+        bool logged = false;
+        for (auto &log : pdoc.logs())
+          logged |= log.code() == log_t::RENDER_ABORTED &&
+                    log.description().starts_with(
+                        "render aborted, budget exceeded: " +
+                        std::string(test.aborts));
+        if (!logged) {
+          std::cerr << "The aborted render was not logged\n";
+          return 6;
+        }
+      }
+
+      std::stringstream serial_expects;
+      expects.print(serial_expects);
 
-  std::stringstream serial_result;
-  result.print(serial_result);
-  std::stringstream serial_expects;
+      if (serial_result.str() != serial_expects.str()) {
+        std::cerr << "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n";
+        result.print(std::cerr);
+        std::cerr << "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n";
 
-  expects.print(serial_expects);
+        expects.print(std::cerr);
+        std::cerr << "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n";
 
-  if (serial_result.str() == serial_expects.str()) {
-    return 0;
-  } else {
-    std::cerr << "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n";
-    result.print(std::cerr);
-    std::cerr << "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n";
+        return 2;
+      }
+      first = serial_result.str();
+    }
+    // The first render also fills the buffers reused by the later ones.
+    else {
+      if (serial_result.str() != first) {
+        std::cerr << "Render " << run << " differs from the first one:\n"
+                  << serial_result.str();
+        return 4;
+      }
+      worst.allocations = std::max(worst.allocations, usage.allocations);
+      worst.bytes = std::max(worst.bytes, usage.bytes);
+    }
+  }
 
-    expects.print(std::cerr);
-    std::cerr << "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n";
+  // Sorting every collection on the thread pool must give the same order.
+  pdoc.parallel_threshold(2);
+  std::stringstream serial_parallel;
+  pdoc.parse().print(serial_parallel);
+  if (serial_parallel.str() != first) {
+    std::cerr << "Parallel sort differs:\n" << serial_parallel.str();
+    return 3;
+  }
 
-    return 2;
+  std::cerr << "Allocations per render: " << worst.allocations << " ("
+            << worst.bytes << " bytes)\n";
+
+  // Checked last, so that a skip on another standard library hides no other
+  // failure. How far a render gets before its deadline depends on the machine.
+  if (argc > 2 && test.limits.deadline.count() == 0) {
+    std::filesystem::path baseline = argv[2];
+    if (std::getenv("VS_TEMPL_RECORD_BASELINES") != nullptr) {
+      std::filesystem::create_directories(baseline.parent_path());
+      std::ofstream(baseline) << worst.allocations << " " << worst.bytes << " "
+                              << standard_library() << "\n";
+    } else if (std::ifstream file(baseline); file) {
+      usage_t expected;
+      std::string library;
+      file >> expected.allocations >> expected.bytes >> library;
+      if (library != standard_library()) {
+        std::cerr << "Baseline recorded with " << library << ", not "
+                  << standard_library() << "\n";
+        return 77;
+      } else if (worst.allocations > expected.allocations ||
+                 worst.bytes > expected.bytes) {
+        std::cerr << "Usage per render went up from " << expected.allocations
+                  << " allocations (" << expected.bytes << " bytes) to "
+                  << worst.allocations << " (" << worst.bytes << " bytes)\n";
+        return 5;
+      }
+    } else {
+      std::cerr << "No baseline at " << baseline
+                << ", record it with VS_TEMPL_RECORD_BASELINES=1\n";
+      return 5;
+    }
   }
+
+  return 0;
 }
@@ -0,0 +1,147 @@
+/**
+ * @file registry.cpp
+ * @author karurochari
+ * @brief Test for the registry of compiled templates of vs.templ
+ * The template of a test file is compiled once through the registry, and its
+ * renders must match the ones of a preprocessor bound to the same data.
+ * Repeated lookups must hit, and a registry with no room left must evict the
+ * oldest template while keeping it usable by whoever still holds it. A
+ * template file modified after being loaded must be reloaded.
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <cassert>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <pugixml.hpp>
+#include <registry.hpp>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vs-templ.hpp>
+
+#include "common.hpp"
+
+using namespace vs::templ;
+
+int main(int argc, const char **argv) {
+  assert(argc > 1);
+  test_case test;
+  if (int ret = test.load(argv[1]); ret != 0)
+    return ret;
+
+  // Named roots belong to a preprocessor, compiled templates only take the
+  // main one.
+  if (test.has_named_data())
+    return 77;
+
+  auto data = test.data;
+  auto tmpl = test.tmpl;
+  uint64_t seed = test.seed;
+
+  std::string reference, saved;
+  {
+    preprocessor pdoc(data, tmpl, "s:", seed);
+    test.setup(pdoc);
+    render_context ctx;
+    pdoc.render(ctx);
+    std::stringstream serial, full;
+    ctx.result().print(serial);
+    ctx.result().save(full);
+    reference = serial.str();
+    saved = full.str();
+  }
+
+  std::stringstream source;
+  for (auto &child : tmpl.children())
+    child.print(source, "", pugi::format_raw);
+
+  template_registry registry({.seed = seed, .limits = test.limits});
+  auto first = registry.get("case", source.str());
+  auto second = registry.get("case", source.str());
+  if (first == nullptr || first != second) {
+    std::cerr << "The registry did not return the same template twice\n";
+    return 3;
+  }
+
+  {
+    render_context ctx;
+    first->render(ctx, data);
+    std::stringstream serial;
+    ctx.result().print(serial);
+    if (serial.str() != reference) {
+      std::cerr << "Render of the compiled template differs:\n"
+                << serial.str() << "\nexpected:\n"
+                << reference;
+      return 2;
+    }
+  }
+  {
+    std::stringstream serial;
+    pugi::xml_writer_stream sink(serial);
+    if (!test.aborted_as_expected(first->render(data, sink)) ||
+        serial.str() != saved) {
+      std::cerr << "Render to a sink differs\n";
+      return 2;
+    }
+  }
+
+  auto stats = registry.stats();
+  if (stats.hits != 1 || stats.misses != 1 || stats.entries != 1 ||
+      stats.cost != first->cost()) {
+    std::cerr << "Unexpected statistics\n";
+    return 3;
+  }
+
+  if (registry.get("broken", "<unclosed>") != nullptr ||
+      registry.stats().failures != 1) {
+    std::cerr << "A broken template was accepted\n";
+    return 3;
+  }
+
+  template_registry small(
+      {.max_cost = 1, .seed = seed, .limits = test.limits});
+  auto evicted = small.get("a", source.str());
+  small.get("b", source.str());
+  stats = small.stats();
+  if (stats.evictions != 1 || stats.entries != 1) {
+    std::cerr << "The oldest template was not evicted\n";
+    return 3;
+  }
+  {
+    render_context ctx;
+    evicted->render(ctx, data);
+    std::stringstream serial;
+    ctx.result().print(serial);
+    if (serial.str() != reference) {
+      std::cerr << "An evicted template is no longer usable\n";
+      return 2;
+    }
+  }
+
+  // Templates loaded from files are reloaded once modified.
+  {
+    auto path = std::filesystem::temp_directory_path() /
+                ("vs-templ-registry-" + std::to_string(getpid()) + ".xml");
+    std::ofstream(path) << source.str();
+    template_registry files(
+        {.check_mtime = true, .seed = seed, .limits = test.limits});
+    auto loaded = files.get(path.string());
+    std::filesystem::last_write_time(
+        path, std::filesystem::last_write_time(path) + std::chrono::seconds(1));
+    auto reloaded = files.get(path.string());
+    auto again = files.get(path.string());
+    std::filesystem::remove(path);
+    stats = files.stats();
+    if (loaded == nullptr || reloaded == loaded || again != reloaded ||
+        stats.reloads != 1 || stats.hits != 1) {
+      std::cerr << "A modified template file was not reloaded once\n";
+      return 3;
+    }
+  }
+
+  return 0;
+}
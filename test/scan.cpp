@@ -0,0 +1,90 @@
+/**
+ * @file scan.cpp
+ * @author karurochari
+ * @brief Test for the scanning kernels of vs.templ
+ * Every implementation supported by the running CPU must agree with the
+ * scalar one on random inputs, including short tails and strings ending right
+ * before an unmapped page. `split_string`, built on top of them, must keep
+ * empty segments.
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <scan.hpp>
+#include <string>
+#include <string_view>
+#include <utils.hpp>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace vs::templ;
+
+static int failures = 0;
+
+static void check(bool condition, const std::string &what) {
+  if (!condition) {
+    std::cerr << "Failed: " << what << "\n";
+    failures++;
+  }
+}
+
+// Plain text with one interesting byte in `every`, at random places.
+static std::string make_input(std::mt19937 &rng, size_t size, size_t every,
+                              const char *specials) {
+  std::string ret(size, 'a');
+  for (auto &c : ret)
+    c = 'a' + rng() % 26;
+  for (size_t i = 0; i < size / every; i++)
+    ret[rng() % size] = specials[rng() % strlen(specials)];
+  return ret;
+}
+
+static void compare(const scan_kernels_t &k, const scan_kernels_t &scalar,
+                    const char *str, size_t len) {
+  check(k.find_any(str, len, '/', '~') == scalar.find_any(str, len, '/', '~'),
+        std::string(k.name) + " find_any");
+  check(k.find_escape(str, len, false) == scalar.find_escape(str, len, false),
+        std::string(k.name) + " find_escape on text");
+  check(k.find_escape(str, len, true) == scalar.find_escape(str, len, true),
+        std::string(k.name) + " find_escape on attributes");
+}
+
+int main() {
+  std::mt19937 rng(42);
+  auto kernels = scan_all_kernels();
+  auto &scalar = *kernels.front();
+
+  for (int i = 0; i < 2000; i++) {
+    auto input = make_input(rng, rng() % 100, 7, "/~&<>\"\t\n\r\x01\x80");
+    for (auto *k : kernels)
+      compare(*k, scalar, input.c_str(), input.size());
+  }
+
+  // Strings ending at the last byte of a page followed by an unmapped one.
+  size_t page = sysconf(_SC_PAGESIZE);
+  auto *pages = (char *)mmap(nullptr, 2 * page, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pages != MAP_FAILED && mprotect(pages + page, page, PROT_NONE) == 0) {
+    for (size_t len = 0; len < 70; len++) {
+      auto input = make_input(rng, len, 5, "/~&<>\"\x01");
+      char *str = pages + page - len - 1;
+      memcpy(str, input.c_str(), len + 1);
+      for (auto *k : kernels)
+        compare(*k, scalar, str, len);
+    }
+    munmap(pages, 2 * page);
+  }
+
+  using views = std::vector<std::string_view>;
+  check(split_string("a,b", ',') == views{"a", "b"}, "split_string");
+  check(split_string("", ',') == views{""}, "split_string on empty strings");
+  check(split_string("a,,b,", ',') == views{"a", "", "b", ""},
+        "split_string keeps empty segments");
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file stream.cpp
+ * @author karurochari
+ * @brief Test for chunked renders of vs.templ
+ * The chunks of a streamed render, once joined, must parse to the same
+ * document as the one obtained by a normal render. Small chunks and a small
+ * buffer are used so that the render has to wait for its consumer. Leaving
+ * the generator after the first chunk must stop the render. A single write
+ * larger than the buffer must still wait for its consumer.
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <pugixml.hpp>
+#include <sstream>
+#include <stream.hpp>
+#include <string>
+#include <thread>
+#include <vs-templ.hpp>
+
+#include "common.hpp"
+
+using namespace vs::templ;
+
+int main(int argc, const char **argv) {
+  assert(argc > 1);
+  test_case test;
+  if (int ret = test.load(argv[1]); ret != 0)
+    return ret;
+
+  preprocessor shared(test.data, test.tmpl, "s:", test.seed);
+  test.setup(shared);
+  const preprocessor &pdoc = shared;
+
+  std::string reference;
+  {
+    render_context ctx;
+    pdoc.render(ctx);
+    std::stringstream serial;
+    ctx.result().print(serial);
+    reference = serial.str();
+  }
+
+  std::string streamed;
+  {
+    render_context ctx;
+    for (auto chunk : render_chunks(pdoc, ctx, {7, 16}))
+      streamed += chunk;
+    if (!test.aborted_as_expected(ctx.aborted()))
+      return 5;
+  }
+  // What was written before an abort is not a whole document.
+  if (strcmp(test.aborts, "none") != 0)
+    return 0;
+
+  pugi::xml_document joined;
+  if (!joined.load_string(streamed.c_str())) {
+    std::cerr << "Streamed output is not valid XML:\n" << streamed << "\n";
+    return 2;
+  }
+  std::stringstream serial;
+  joined.print(serial);
+  if (serial.str() != reference) {
+    std::cerr << "Streamed output differs\n--- Streamed ---\n"
+              << serial.str() << "\n--- Expected ---\n"
+              << reference << "\n";
+    return 3;
+  }
+
+  {
+    render_context ctx;
+    for (auto chunk : render_chunks(pdoc, ctx, {7, 16})) {
+      (void)chunk;
+      break;
+    }
+    if (ctx.aborted() != abort_t::NONE &&
+        ctx.aborted() != abort_t::CANCELLED) {
+      std::cerr << "Unexpected abort reason\n";
+      return 4;
+    }
+  }
+
+  // A single large write must wait for the consumer instead of going over
+  // the bound of the buffer.
+  {
+    stream_buffer buffer(16);
+    std::string large(1000, 'x'), received, chunk;
+    std::atomic<bool> written = false;
+    std::thread producer([&]() {
+      buffer.write(large);
+      written = true;
+      buffer.close();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    bool waited = !written;
+    while (buffer.read(chunk, 7))
+      received += chunk;
+    producer.join();
+    if (!waited || received != large) {
+      std::cerr << "Large writes are not bounded by the buffer\n";
+      return 6;
+    }
+  }
+
+  return 0;
+}
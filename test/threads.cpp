@@ -0,0 +1,83 @@
+/**
+ * @file threads.cpp
+ * @author karurochari
+ * @brief Stress test for concurrent renders of vs.templ
+ * Many threads render the same test file against shared data and template
+ * trees, each one with its own render context. Every output must match the
+ * one obtained by a single-threaded render. Build with `-Db_sanitize=thread`
+ * to have data races reported as well. VS_TEMPL_TEST_THREADS and
+ * VS_TEMPL_TEST_ROUNDS lower the load on slow machines.
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <pugixml.hpp>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <vs-templ.hpp>
+
+#include "common.hpp"
+
+using namespace vs::templ;
+
+// Overrides of the default load, only meant to lower it on slow machines.
+static int from_env(const char *name, int fallback) {
+  const char *value = std::getenv(name);
+  return value != nullptr && std::atoi(value) > 0 ? std::atoi(value)
+                                                  : fallback;
+}
+
+int main(int argc, const char **argv) {
+  assert(argc > 1);
+  test_case test;
+  if (int ret = test.load(argv[1]); ret != 0)
+    return ret;
+
+  // Enough to have every render overlap with many others.
+  const int threads = from_env("VS_TEMPL_TEST_THREADS", 48);
+  const int rounds = from_env("VS_TEMPL_TEST_ROUNDS", 16);
+
+  preprocessor shared(test.data, test.tmpl, "s:", test.seed);
+  test.setup(shared);
+  const preprocessor &pdoc = shared;
+
+  std::string reference;
+  {
+    render_context ctx;
+    pdoc.render(ctx);
+    std::stringstream serial;
+    ctx.result().print(serial);
+    reference = serial.str();
+  }
+
+  std::atomic<int> mismatches = 0;
+  std::vector<std::thread> workers;
+  workers.reserve(threads);
+
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&]() {
+      render_context ctx;
+      for (int r = 0; r < rounds; r++) {
+        pdoc.render(ctx);
+        std::stringstream serial;
+        ctx.result().print(serial);
+        if (serial.str() != reference)
+          mismatches++;
+      }
+    });
+  }
+
+  for (auto &worker : workers)
+    worker.join();
+
+  if (mismatches != 0) {
+    std::cerr << mismatches << " concurrent renders differ from the reference\n";
+    return 2;
+  }
+  return 0;
+}